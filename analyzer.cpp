@@ -1,34 +1,54 @@
 #include "analyzer.h"
+#include "csv_scan.h"
+#include "topk.h"
+#include "bounded_queue.h"
+#include "chunk_scheduler.h"
 #include <fstream>
 #include <algorithm>
 #include <cctype>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-string TripAnalyzer::trim(const string& s) {
+using Clock = chrono::steady_clock;
+
+static long long nanos(Clock::duration d) {
+    return chrono::duration_cast<chrono::nanoseconds>(d).count();
+}
+
+// Adds its own lifetime to a nanosecond counter.
+struct ScopedTimer {
+    long long& acc;
+    Clock::time_point t0 = Clock::now();
+    explicit ScopedTimer(long long& a) : acc(a) {}
+    ~ScopedTimer() { acc += nanos(Clock::now() - t0); }
+};
+
+string_view TripAnalyzer::trim(string_view s) {
     size_t a = s.find_first_not_of(" \t\r\n");
-    if (a == string::npos) return "";
+    if (a == string_view::npos) return {};
     size_t b = s.find_last_not_of(" \t\r\n");
     return s.substr(a, b - a + 1);
 }
 
-bool TripAnalyzer::split6(const string& line, string out[6]) {
-    size_t start = 0;
-    for (int i = 0; i < 6; i++) {
-        size_t pos = (i == 5) ? string::npos : line.find(',', start);
-        if (pos == string::npos && i != 5) return false;
-        out[i] = trim(line.substr(start, pos - start));
-        start = (pos == string::npos) ? line.size() : pos + 1;
-    }
-    return true;
-}
-
-bool TripAnalyzer::parseHour(const string& dtRaw, int& hourOut) {
-    string s = trim(dtRaw);
+TripAnalyzer::RowStatus TripAnalyzer::parseHour(string_view dtRaw, int& hourOut) {
+    string_view s = trim(dtRaw);
     size_t c = s.find(':');
-    if (c == string::npos) return false;
+    if (c == string_view::npos) return RowBadTime;
 
     int i = (int)c - 1;
     while (i >= 0 && isspace((unsigned char)s[i])) i--;
-    if (i < 0 || !isdigit((unsigned char)s[i])) return false;
+    if (i < 0 || !isdigit((unsigned char)s[i])) return RowBadTime;
 
     int h = s[i] - '0';
     i--;
@@ -36,90 +56,1395 @@ bool TripAnalyzer::parseHour(const string& dtRaw, int& hourOut) {
     if (i >= 0 && isdigit((unsigned char)s[i])) {
         h = (s[i] - '0') * 10 + h;
         i--;
-        if (i >= 0 && isdigit((unsigned char)s[i])) return false;
+        if (i >= 0 && isdigit((unsigned char)s[i])) return RowHourRange;
     }
 
-    if (h < 0 || h > 23) return false;
+    if (h < 0 || h > 23) return RowHourRange;
     hourOut = h;
+    return RowOk;
+}
+
+static bool digits(string_view s, size_t from, size_t n, int& out) {
+    out = 0;
+    for (size_t i = from; i < from + n; i++) {
+        if (!isdigit((unsigned char)s[i])) return false;
+        out = out * 10 + (s[i] - '0');
+    }
     return true;
 }
 
-void TripAnalyzer::processLine(const string& line) {
-    if (line.empty()) return;
+// Days since 1970-01-01 of a proleptic Gregorian date (Hinnant's
+// days_from_civil).
+static int32_t daysFromCivil(int y, int m, int d) {
+    y -= m <= 2;
+    int era = y / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
 
-    string f[6];
-    if (!split6(line, f)) return;
+// Leading "YYYY-MM-DD" of the trimmed field, followed by the end, a space
+// or 'T'. Dates before 1970 are rejected so day indexes stay unsigned.
+bool TripAnalyzer::parseDay(string_view dtRaw, int32_t& dayOut) {
+    string_view s = trim(dtRaw);
+    if (s.size() < 10 || s[4] != '-' || s[7] != '-') return false;
+    if (s.size() > 10 && s[10] != ' ' && s[10] != 'T') return false;
 
-    const string& zone = f[1];
-    const string& dt = f[3];
-    if (zone.empty() || dt.empty()) return;
+    int y, m, d;
+    if (!digits(s, 0, 4, y) || !digits(s, 5, 2, m) || !digits(s, 8, 2, d)) return false;
+    if (y < 1970 || m < 1 || m > 12 || d < 1) return false;
 
-    int h;
-    if (!parseHour(dt, h)) return;
+    static const int mdays[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    if (d > mdays[m - 1] + (m == 2 && leap)) return false;
 
-    ZoneStats& z = stats[zone];
-    z.total++;
-    z.byHour[h]++;
+    dayOut = daysFromCivil(y, m, d);
+    return true;
 }
 
-void TripAnalyzer::ingestFile(const string& csvPath) {
+// Fixed-point decimal: optional sign, digits, optional '.' and fraction,
+// scaled by 10^decimals and rounded half away from zero on the first
+// dropped digit. No exponents, no locale, at most 15 integer digits.
+bool TripAnalyzer::parseFixed(string_view s, int decimals, long long& out) {
+    s = trim(s);
+    size_t i = 0;
+    bool neg = false;
+    if (i < s.size() && (s[i] == '-' || s[i] == '+')) neg = s[i++] == '-';
+
+    long long v = 0;
+    int intDigits = 0, fracDigits = 0;
+    for (; i < s.size() && isdigit((unsigned char)s[i]); i++, intDigits++) {
+        if (intDigits == 15) return false;
+        v = v * 10 + (s[i] - '0');
+    }
+
+    bool roundUp = false;
+    if (i < s.size() && s[i] == '.') {
+        for (i++; i < s.size() && isdigit((unsigned char)s[i]); i++, fracDigits++) {
+            if (fracDigits < decimals) v = v * 10 + (s[i] - '0');
+            else if (fracDigits == decimals) roundUp = s[i] >= '5';
+        }
+    }
+    if (i != s.size() || intDigits + fracDigits == 0) return false;
+
+    for (int d = fracDigits; d < decimals; d++) v *= 10;
+    v += roundUp;
+    out = neg ? -v : v;
+    return true;
+}
+
+bool TripAnalyzer::isHeader(string_view line) {
+    return line.find("TripID") != string_view::npos &&
+           line.find("PickupZoneID") != string_view::npos;
+}
+
+void MetricSummary::add(long long v) {
+    if (n == 0 || v < min) min = v;
+    if (n == 0 || v > max) max = v;
+    n++;
+    sum += v;
+}
+
+MetricSummary& MetricSummary::operator+=(const MetricSummary& o) {
+    if (o.n == 0) return *this;
+    if (n == 0 || o.min < min) min = o.min;
+    if (n == 0 || o.max > max) max = o.max;
+    n += o.n;
+    sum += o.sum;
+    return *this;
+}
+
+void TripAnalyzer::ZoneTable::add(const Trip& t) {
+    if (zoneSketch.capacity()) {
+        zoneSketch.add(t.zone);
+        slotKey.assign(t.zone.data(), t.zone.size());
+        slotKey.push_back((char)t.hour);
+        slotSketch.add(slotKey);
+        return;
+    }
+
+    uint32_t id = dict.intern(t.zone);
+    if (id == zones.size()) zones.resize(id + 1);
+    zones.add(id, t.hour);
+    if (t.day >= 0) dayCells.add(cellKey(id, t.day, t.hour));
+    if (!t.dropoff.empty()) routes.add(routeKey(id, dropoffs.intern(t.dropoff)));
+
+    if (t.fare != kNoValue || t.distance != kNoValue) {
+        SlotMetrics& m = metricsAt(id, t.hour);
+        if (t.fare != kNoValue) m.fare.add(t.fare);
+        if (t.distance != kNoValue) m.distance.add(t.distance);
+    }
+}
+
+TripAnalyzer::SlotMetrics& TripAnalyzer::ZoneTable::metricsAt(uint32_t id, int hour) {
+    uint64_t key = cellKey(id, 0, hour);
+    uint64_t i = metricIndex.get(key);
+    if (i == 0) {
+        metrics.emplace_back();
+        i = metrics.size();
+        metricIndex.add(key, i);
+    }
+    return metrics[i - 1];
+}
+
+// Zones new to this table get ids after its own, in other's id order.
+// Which worker saw a zone first depends on the schedule, so ids may differ
+// from a serial pass; counts do not, and every query ranks by count and
+// then by name, so the results are the same.
+void TripAnalyzer::ZoneTable::mergeFrom(const ZoneTable& other) {
+    if (&other == this) {
+        // The loops below add to the tables they walk, which may grow them.
+        ZoneTable copy = other;
+        mergeFrom(copy);
+        return;
+    }
+    if (zoneSketch.capacity() || other.zoneSketch.capacity()) {
+        mergeApprox(other);
+        return;
+    }
+    if (zones.empty()) {
+        dict = other.dict;
+        zones = other.zones;
+        dayCells = other.dayCells;
+        dropoffs = other.dropoffs;
+        routes = other.routes;
+        metricIndex = other.metricIndex;
+        metrics = other.metrics;
+        return;
+    }
+
+    vector<uint32_t> remap(other.zones.size());
+    for (uint32_t i = 0; i < other.zones.size(); i++) {
+        uint32_t id = dict.intern(other.dict.name(i));
+        if (id == zones.size()) zones.resize(id + 1);
+        remap[i] = id;
+        other.zones.forEachHour(i, [&](int h, long long c) { zones.add(id, h, c); });
+    }
+
+    other.dayCells.forEach([&](uint64_t key, uint64_t count) {
+        dayCells.add(cellKey(remap[cellZone(key)], cellDay(key), cellHour(key)), count);
+    });
+
+    other.metricIndex.forEach([&](uint64_t key, uint64_t i) {
+        SlotMetrics& m = metricsAt(remap[cellZone(key)], cellHour(key));
+        m.fare += other.metrics[i - 1].fare;
+        m.distance += other.metrics[i - 1].distance;
+    });
+
+    if (other.routes.empty()) return;
+    vector<uint32_t> dropRemap(other.dropoffs.size());
+    for (uint32_t i = 0; i < other.dropoffs.size(); i++)
+        dropRemap[i] = dropoffs.intern(other.dropoffs.name(i));
+    other.routes.forEach([&](uint64_t key, uint64_t count) {
+        routes.add(routeKey(remap[routeFrom(key)], dropRemap[routeTo(key)]), count);
+    });
+}
+
+// Exact counts enter a summary as weighted adds, which keeps its bounds; an
+// exact table merged with an approximate one becomes approximate.
+void TripAnalyzer::ZoneTable::mergeApprox(const ZoneTable& other) {
+    if (!zoneSketch.capacity()) {
+        ZoneTable exact;
+        exact.swap(*this);
+        setApprox(other.zoneSketch.capacity());
+        addExact(exact);
+    }
+    if (other.zoneSketch.capacity()) {
+        zoneSketch.mergeFrom(other.zoneSketch);
+        slotSketch.mergeFrom(other.slotSketch);
+    } else {
+        addExact(other);
+    }
+}
+
+void TripAnalyzer::ZoneTable::addExact(const ZoneTable& exact) {
+    for (uint32_t id = 0; id < exact.zones.size(); id++) {
+        const string& name = exact.dict.name(id);
+        zoneSketch.add(name, exact.zones.total(id));
+        exact.zones.forEachHour(id, [&](int h, long long c) {
+            slotKey = name;
+            slotKey.push_back((char)h);
+            slotSketch.add(slotKey, c);
+        });
+    }
+}
+
+// Checks run in RowStatus order. The optional fields are left untrimmed;
+// only the tracking options look at them.
+TripAnalyzer::RowStatus TripAnalyzer::parseRow(const CsvRow& row, RowFields& f) {
+    if (row.begin == row.end) return RowBlank;
+    if (row.commas < 5) return RowTooFewFields;
+
+    f.zone = trim(string_view(row.comma[0] + 1, row.comma[1] - row.comma[0] - 1));
+    if (f.zone.empty()) return RowEmptyZone;
+    f.dropoff = string_view(row.comma[1] + 1, row.comma[2] - row.comma[1] - 1);
+    f.distance = string_view(row.comma[3] + 1, row.comma[4] - row.comma[3] - 1);
+    f.fare = string_view(row.comma[4] + 1, row.end - row.comma[4] - 1);
+
+    f.dt = trim(string_view(row.comma[2] + 1, row.comma[3] - row.comma[2] - 1));
+    if (f.dt.empty()) return RowEmptyTime;
+    return parseHour(f.dt, f.hour);
+}
+
+// The optional parts of an accepted row, each parsed only when its option
+// is on; a missing or bad value is counted and leaves that part absent
+// (the parsers only write on success).
+TripAnalyzer::Trip TripAnalyzer::makeTrip(const RowFields& f, const IngestOptions& o,
+                                          IngestStats& st) {
+    Trip t;
+    t.zone = f.zone;
+    t.hour = f.hour;
+    if (o.trackDates && !parseDay(f.dt, t.day)) st.undated++;
+    if (o.trackRoutes) {
+        t.dropoff = trim(f.dropoff);
+        if (t.dropoff.empty()) st.noDropoff++;
+    }
+    if (o.trackMetrics) {
+        if (!parseFixed(f.fare, 2, t.fare)) st.badFare++;
+        if (!parseFixed(f.distance, 1, t.distance)) st.badDistance++;
+    }
+    return t;
+}
+
+void TripAnalyzer::countRows(const unsigned long long (&counts)[RowStatusCount], IngestStats& st) {
+    st.rowsAccepted += counts[RowOk];
+    st.blankLines += counts[RowBlank];
+    st.tooFewFields += counts[RowTooFewFields];
+    st.emptyZone += counts[RowEmptyZone];
+    st.emptyTime += counts[RowEmptyTime];
+    st.badTime += counts[RowBadTime];
+    st.hourOutOfRange += counts[RowHourRange];
+    for (unsigned long long c : counts) st.rows += c;
+}
+
+// Rows are parsed into a small batch, then the batch is aggregated, so
+// the two phases can be timed with a few clock reads per batch instead
+// of per row. No header handling here; see ingestBuffer.
+void TripAnalyzer::ingestRange(const char* b, const char* e, const IngestOptions& o,
+                               ZoneTable& into, IngestStats& st) {
+    const int kBatch = 512;
+    Trip batch[kBatch];
+    int n = 0;
+    unsigned long long counts[RowStatusCount] = {0};
+
+    auto t0 = Clock::now();
+    auto flush = [&]() {
+        auto t1 = Clock::now();
+        for (int i = 0; i < n; i++) into.add(batch[i]);
+        auto t2 = Clock::now();
+        st.parseNs += nanos(t1 - t0);
+        st.aggregateNs += nanos(t2 - t1);
+        t0 = t2;
+        n = 0;
+    };
+
+    forEachRow(b, e, [&](const CsvRow& row) {
+        RowFields f;
+        RowStatus s = parseRow(row, f);
+        counts[s]++;
+        if (s != RowOk) return;
+
+        batch[n++] = makeTrip(f, o, st);
+        if (n == kBatch) flush();
+    });
+    flush();
+
+    countRows(counts, st);
+}
+
+// IngestOptions::threads, with 0 or less meaning one per core.
+int TripAnalyzer::threadCount() const {
+    return opts.threads > 0 ? opts.threads : (int)thread::hardware_concurrency();
+}
+
+int TripAnalyzer::workerCount(size_t bytes) const {
+    // Below this a thread costs more to start than it saves.
+    const size_t minBytesPerWorker = 1 << 20;
+
+    int n = threadCount();
+    if (n <= 1) return 1;
+
+    size_t bySize = bytes / minBytesPerWorker;
+    if (bySize < (size_t)n) n = (int)max<size_t>(bySize, 1);
+    return n;
+}
+
+void TripAnalyzer::ingestBuffer(const char* data, size_t size) {
+    const char* p = data;
+    const char* end = data + size;
+
+    int n = workerCount(end - p);
+    if (n == 1) {
+        ingestRange(p, end, opts, stats, lastIngest);
+        return;
+    }
+
+    // Small newline-aligned chunks, many per worker, so the scheduler has
+    // something to rebalance when some regions parse slower than others.
+    const size_t kChunksPerWorker = 64;
+    size_t chunkBytes = clamp<size_t>((end - p) / ((size_t)n * kChunksPerWorker),
+                                      256 << 10, 4 << 20);
+    vector<const char*> cuts{p};
+    while (cuts.back() < end) {
+        const char* c = cuts.back() + min<size_t>(chunkBytes, end - cuts.back());
+        const char* nl = c < end ? (const char*)memchr(c, '\n', end - c) : nullptr;
+        cuts.push_back(nl ? nl + 1 : end);
+    }
+
+    // Space-Saving summaries depend on how the rows are split, so the
+    // approximate mode keeps every worker on its own share for results that
+    // do not change between runs. Exact counts do not care.
+    ChunkScheduler sched((uint32_t)(cuts.size() - 1), n, opts.approxEntries == 0);
+    vector<ZoneTable> local(n);
+    for (ZoneTable& t : local) t.setApprox(opts.approxEntries);
+    vector<IngestStats> localStats(n);
+    auto work = [&](int i) {
+        uint32_t c;
+        while (sched.next(i, c)) ingestRange(cuts[c], cuts[c + 1], opts, local[i], localStats[i]);
+    };
+    vector<thread> workers;
+    workers.reserve(n - 1);
+    for (int i = 1; i < n; i++) workers.emplace_back(work, i);
+    work(0);
+    for (auto& t : workers) t.join();
+
+    // Merge in worker order; the counts are the same whoever parsed what.
+    mergeWorkers(local, localStats);
+}
+
+// The workers' tables become the counts, and their stats add up into
+// lastIngest. The merge is timed as mergeNs.
+void TripAnalyzer::mergeWorkers(vector<ZoneTable>& local, const vector<IngestStats>& localStats) {
+    auto t0 = Clock::now();
+    stats.swap(local[0]);
+    for (size_t i = 1; i < local.size(); i++) stats.mergeFrom(local[i]);
+    lastIngest.mergeNs += nanos(Clock::now() - t0);
+
+    for (const IngestStats& ls : localStats) lastIngest += ls;
+}
+
+// The header can only be the first line.
+const char* TripAnalyzer::skipHeader(const char* p, const char* end) {
+    if (p == end) return p;
+    const char* nl = (const char*)memchr(p, '\n', end - p);
+    const char* lineEnd = nl ? nl : end;
+    return isHeader(string_view(p, lineEnd - p)) ? (nl ? nl + 1 : end) : p;
+}
+
+// Fills blocks of at least kBlock fresh bytes from read() and trims each to
+// its last complete line; the partial line is carried to the front of the
+// next block. A line that does not fit grows the buffer, so a block is at
+// most the carried bytes plus one read past kBlock plus the longest line.
+// Rows split exactly as in a mapped file, and a header is skipped if the
+// stream starts at the beginning of its file.
+class TripAnalyzer::BlockSource {
+public:
+    static const size_t kBlock = 1 << 20;
+
+    BlockSource(const function<size_t(char*, size_t)>& r, IngestStats& s, bool atFileStart = true)
+        : read(r), st(s), header(atFileStart) {}
+
+    // Loads the next block into buf; bytes [begin, len) are whole lines
+    // (the last one unterminated only at EOF). False once input is done.
+    bool next(vector<char>& buf, size_t& begin, size_t& len) {
+        if (done) return false;
+        size_t end = carry.size();
+        if (buf.size() < end + 2 * kBlock) buf.resize(end + 2 * kBlock);
+        if (end) memcpy(buf.data(), carry.data(), end);
+        size_t searched = end;      // the carried bytes never hold a '\n'
+
+        for (;;) {
+            size_t target = end + kBlock;
+            if (buf.size() < target) buf.resize(max(target, buf.size() * 2));
+            {
+                ScopedTimer timer(st.readNs);
+                while (!eof && end < target) {
+                    size_t got = read(buf.data() + end, buf.size() - end);
+                    if (got == 0) eof = true;
+                    st.bytesRead += got;
+                    end += got;
+                }
+            }
+
+            size_t cut = end;
+            if (!eof) {
+                while (cut > searched && buf[cut - 1] != '\n') cut--;
+                if (cut == searched) {
+                    searched = end;     // no line ends in this block yet
+                    continue;
+                }
+            }
+            carry.assign(buf.data() + cut, buf.data() + end);
+            begin = header ? skipHeader(buf.data(), buf.data() + cut) - buf.data() : 0;
+            len = cut;
+            header = false;
+            done = eof;
+            return true;
+        }
+    }
+
+private:
+    const function<size_t(char*, size_t)>& read;
+    IngestStats& st;
+    vector<char> carry;
+    bool header;
+    bool eof = false;
+    bool done = false;
+};
+
+void TripAnalyzer::ingestBlocks(const function<size_t(char*, size_t)>& read, bool atFileStart) {
+    BlockSource src(read, lastIngest, atFileStart);
+    int n = threadCount();
+    if (n > 1) {
+        ingestPipelined(src, n);
+        return;
+    }
+
+    ingestSerial(src, opts, stats, lastIngest);
+}
+
+void TripAnalyzer::ingestSerial(BlockSource& src, const IngestOptions& o, ZoneTable& into,
+                                IngestStats& st) {
+    vector<char> buf;
+    size_t begin, len;
+    while (src.next(buf, begin, len)) ingestRange(buf.data() + begin, buf.data() + len, o, into, st);
+}
+
+// Reader -> parsers pipeline. This thread fills blocks from a fixed pool
+// while the workers parse earlier ones into their own tables, so reading
+// overlaps parsing. The pool holds two blocks per worker: once they are all
+// queued or being parsed, the reader waits for one to come back instead of
+// buffering more input.
+void TripAnalyzer::ingestPipelined(BlockSource& src, int n) {
+    struct Block {
+        vector<char> buf;
+        size_t begin = 0, len = 0;
+    };
+    vector<Block> pool(2 * n);
+    BoundedQueue<Block*> full(pool.size()), spare(pool.size());
+    for (Block& b : pool) spare.push(&b);
+
+    vector<ZoneTable> local(n);
+    for (ZoneTable& t : local) t.setApprox(opts.approxEntries);
+    vector<IngestStats> localStats(n);
+    vector<thread> workers;
+    workers.reserve(n);
+    for (int i = 0; i < n; i++)
+        workers.emplace_back([&, i] {
+            Block* b;
+            while (full.pop(b)) {
+                ingestRange(b->buf.data() + b->begin, b->buf.data() + b->len, opts,
+                            local[i], localStats[i]);
+                spare.push(b);
+            }
+        });
+
+    Block* b;
+    while (spare.pop(b) && src.next(b->buf, b->begin, b->len)) full.push(b);
+    full.close();
+    for (auto& t : workers) t.join();
+
+    // Which worker got which block depends on scheduling; the counts do not.
+    mergeWorkers(local, localStats);
+}
+
+void TripAnalyzer::beginIngest() {
     stats.clear();
+    stats.setApprox(opts.approxEntries);
+    invalidateRankings();
+    lastIngest = IngestStats();
+    sourceKnown = false;
+    tails.clear();
+}
 
-    ifstream file(csvPath);
-    if (!file.is_open()) return;
+void TripAnalyzer::ingestStream(istream& in) {
+    auto t0 = Clock::now();
+    beginIngest();
+    ingestBlocks([&in](char* p, size_t n) {
+        in.read(p, (streamsize)n);
+        return (size_t)in.gcount();
+    });
+    if (in.bad()) lastIngest.readErrors = 1;
+    lastIngest.ingestNs = nanos(Clock::now() - t0);
+}
+
+// A read error ends the input like EOF does, and is reported; EINTR is
+// retried.
+bool TripAnalyzer::ingestFd(int fd) {
+    auto t0 = Clock::now();
+    beginIngest();
+    bool failed = false;
+    ingestBlocks([fd, &failed](char* p, size_t n) -> size_t {
+        for (;;) {
+            ssize_t got = ::read(fd, p, n);
+            if (got >= 0) return (size_t)got;
+            if (errno != EINTR) {
+                failed = true;
+                return 0;
+            }
+        }
+    });
+    if (failed) lastIngest.readErrors = 1;
+    lastIngest.ingestNs = nanos(Clock::now() - t0);
+    return !failed;
+}
 
-    string line;
-    bool first = true;
+// Offset just past the last '\n' in [from, to) of fd, or from if there is
+// none; reads backwards, so only the unfinished last line is scanned.
+static uint64_t lastLineEnd(int fd, uint64_t from, uint64_t to) {
+    char buf[1 << 16];
+    while (to > from) {
+        size_t n = (size_t)min<uint64_t>(sizeof(buf), to - from);
+        ssize_t got = pread(fd, buf, n, (off_t)(to - n));
+        if (got < 0 && errno == EINTR) continue;
+        if (got != (ssize_t)n) return from;
+        for (size_t i = n; i > 0; i--)
+            if (buf[i - 1] == '\n') return to - n + i;
+        to -= n;
+    }
+    return from;
+}
 
-    while (getline(file, line)) {
-        if (first) {
-            first = false;
-            if (line.find("TripID") != string::npos &&
-                line.find("PickupZoneID") != string::npos)
-                continue;
+// Offset just past the first '\n' in [from, to) of fd, to if there is
+// none, or 0 if it cannot be read.
+static uint64_t firstLineEnd(int fd, uint64_t from, uint64_t to) {
+    char buf[1 << 16];
+    while (from < to) {
+        size_t n = (size_t)min<uint64_t>(sizeof(buf), to - from);
+        ssize_t got = pread(fd, buf, n, (off_t)from);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return 0;
+        if (const void* nl = memchr(buf, '\n', (size_t)got))
+            return from + (uint64_t)((const char*)nl - buf) + 1;
+        from += (uint64_t)got;
+    }
+    return to;
+}
+
+// Records that the first size bytes of path have been ingested, so
+// appendFrom carries on from there instead of counting the file again. An
+// unterminated last line was counted as a row (getline semantics), so the
+// offset stays at its start and counted notes it; appendFrom skips that
+// line when its newline arrives. A pipe or FIFO has no offsets to come back
+// to; O_NONBLOCK keeps opening one from waiting for a writer.
+void TripAnalyzer::rememberTail(const string& path, uint64_t size) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) return;
+    struct stat sb;
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+        uint64_t end = min<uint64_t>(size, (uint64_t)sb.st_size);
+        uint64_t offset = lastLineEnd(fd, 0, end);
+        tails[path] = Tail{(uint64_t)sb.st_dev, (uint64_t)sb.st_ino, offset, end - offset};
+    }
+    ::close(fd);
+}
+
+void TripAnalyzer::ingestFile(const string& csvPath) {
+    auto t0 = Clock::now();
+    beginIngest();
+    sourceKnown = statFile(csvPath, source);
+
+    if (opts.useMmap) {
+        MappedFile mf(csvPath);
+        if (mf.ok()) {
+            lastIngest.readNs = nanos(Clock::now() - t0);
+            lastIngest.bytesRead = mf.size();
+            lastIngest.filesRead = 1;
+            const char* p = skipHeader(mf.data(), mf.data() + mf.size());
+            ingestBuffer(p, mf.data() + mf.size() - p);
+            rememberTail(csvPath, mf.size());
+            lastIngest.ingestNs = nanos(Clock::now() - t0);
+            return;
         }
-        processLine(line);
     }
+
+    ifstream file(csvPath, ios::binary);
+    if (file.is_open()) {
+        lastIngest.readNs = nanos(Clock::now() - t0);
+        lastIngest.filesRead = 1;
+        ingestBlocks([&file](char* p, size_t n) {
+            file.read(p, (streamsize)n);
+            return (size_t)file.gcount();
+        });
+        if (file.bad()) lastIngest.readErrors = 1;
+        rememberTail(csvPath, lastIngest.bytesRead);
+    } else {
+        lastIngest.filesFailed = 1;
+    }
+    lastIngest.ingestNs = nanos(Clock::now() - t0);
 }
 
-vector<ZoneCount> TripAnalyzer::topZones(int k) const {
-    if (k <= 0 || stats.empty()) return {};
+// One whole file into a worker's table, mapped when possible.
+bool TripAnalyzer::ingestPath(const string& path, const IngestOptions& o, ZoneTable& into,
+                              IngestStats& st) {
+    if (o.useMmap) {
+        auto t0 = Clock::now();
+        MappedFile mf(path);
+        if (mf.ok()) {
+            st.readNs += nanos(Clock::now() - t0);
+            st.bytesRead += mf.size();
+            st.filesRead++;
+            const char* end = mf.data() + mf.size();
+            ingestRange(skipHeader(mf.data(), end), end, o, into, st);
+            return true;
+        }
+    }
 
-    vector<ZoneCount> v;
-    v.reserve(stats.size());
-    for (const auto& kv : stats)
-        v.push_back({kv.first, kv.second.total});
+    ifstream file(path, ios::binary);
+    if (!file.is_open()) {
+        st.filesFailed++;
+        return false;
+    }
+    st.filesRead++;
+    function<size_t(char*, size_t)> read = [&file](char* p, size_t n) {
+        file.read(p, (streamsize)n);
+        return (size_t)file.gcount();
+    };
+    BlockSource src(read, st);
+    ingestSerial(src, o, into, st);
+    if (file.bad()) st.readErrors++;
+    return true;
+}
 
-    sort(v.begin(), v.end(), [](const ZoneCount& a, const ZoneCount& b) {
-        if (a.count != b.count) return a.count > b.count;
-        return a.zone < b.zone;
+void TripAnalyzer::ingestFiles(const vector<string>& paths) {
+    if (paths.size() == 1) {
+        ingestFile(paths[0]);   // one file gets the chunked parallel path
+        return;
+    }
+    auto t0 = Clock::now();
+    beginIngest();
+
+    // Largest first, so the big files start early and the small ones fill
+    // in the gaps at the end (longest-processing-time order).
+    vector<pair<uint64_t, size_t>> order;
+    order.reserve(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        FileStamp st;
+        order.emplace_back(statFile(paths[i], st) ? st.size : 0, i);
+    }
+    sort(order.begin(), order.end(), [](const pair<uint64_t, size_t>& a, const pair<uint64_t, size_t>& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
     });
 
-    if ((int)v.size() > k) v.resize(k);
+    int n = (int)clamp<size_t>((size_t)threadCount(), 1, max<size_t>(paths.size(), 1));
+
+    // Exact counts let workers claim files as they free up. Approximate
+    // summaries depend on which rows meet in which table, so there each
+    // file goes up front to the least loaded worker instead.
+    vector<vector<size_t>> plan(n);
+    if (opts.approxEntries > 0) {
+        vector<uint64_t> load(n, 0);
+        for (auto& f : order) {
+            int w = (int)(min_element(load.begin(), load.end()) - load.begin());
+            load[w] += f.first + 1;
+            plan[w].push_back(f.second);
+        }
+    }
+    atomic<size_t> nextFile{0};
+
+    vector<ZoneTable> local(n);
+    for (ZoneTable& t : local) t.setApprox(opts.approxEntries);
+    vector<IngestStats> localStats(n);
+    vector<int64_t> fileBytes(paths.size(), -1);   // bytes read, -1 if not opened
+    auto one = [&](int i, size_t f) {
+        unsigned long long before = localStats[i].bytesRead;
+        if (ingestPath(paths[f], opts, local[i], localStats[i]))
+            fileBytes[f] = (int64_t)(localStats[i].bytesRead - before);
+    };
+    auto work = [&](int i) {
+        if (opts.approxEntries > 0) {
+            for (size_t f : plan[i]) one(i, f);
+            return;
+        }
+        for (size_t f; (f = nextFile.fetch_add(1)) < order.size();) one(i, order[f].second);
+    };
+    vector<thread> workers;
+    workers.reserve(n - 1);
+    for (int i = 1; i < n; i++) workers.emplace_back(work, i);
+    work(0);
+    for (auto& t : workers) t.join();
+
+    mergeWorkers(local, localStats);
+    for (size_t f = 0; f < paths.size(); f++)
+        if (fileBytes[f] >= 0) rememberTail(paths[f], (uint64_t)fileBytes[f]);
+    lastIngest.ingestNs = nanos(Clock::now() - t0);
+}
+
+void TripAnalyzer::ingestDirectory(const string& dir, const string& pattern) {
+    vector<string> paths;
+    if (DIR* d = opendir(dir.c_str())) {
+        while (dirent* ent = readdir(d)) {
+            if (fnmatch(pattern.c_str(), ent->d_name, 0) != 0) continue;
+            string path = dir + "/" + ent->d_name;
+            struct stat sb;
+            if (stat(path.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)) paths.push_back(path);
+        }
+        closedir(d);
+    }
+    sort(paths.begin(), paths.end());
+    ingestFiles(paths);
+}
+
+bool TripAnalyzer::appendFrom(const string& path) {
+    auto t0 = Clock::now();
+    lastIngest = IngestStats();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        if (fd >= 0) ::close(fd);
+        lastIngest.filesFailed = 1;
+        return false;
+    }
+    lastIngest.filesRead = 1;
+
+    Tail& tail = tails[path];
+    uint64_t size = (uint64_t)sb.st_size;
+    if (tail.dev != (uint64_t)sb.st_dev || tail.ino != (uint64_t)sb.st_ino || size < tail.offset + tail.counted)
+        tail = Tail{(uint64_t)sb.st_dev, (uint64_t)sb.st_ino, 0};
+
+    bool failed = false;
+    uint64_t cut = lastLineEnd(fd, tail.offset, size);
+    if (cut > tail.offset && tail.counted) {
+        // The line an ingest already counted is complete now: skip it.
+        uint64_t next = firstLineEnd(fd, tail.offset + tail.counted, cut);
+        if (next) {
+            tail.offset = next;
+            tail.counted = 0;
+        } else {
+            failed = true;
+        }
+    }
+    if (!failed && cut > tail.offset) {
+        // The new rows go into a table of their own, as the parallel paths
+        // expect, and are then merged: time and memory in the new bytes.
+        ZoneTable added;
+        added.setApprox(opts.approxEntries);
+        added.swap(stats);
+        uint64_t pos = tail.offset, lineEnd = tail.offset;
+        ingestBlocks([&](char* p, size_t n) -> size_t {
+            n = (size_t)min<uint64_t>(n, cut - pos);
+            while (n) {
+                ssize_t got = pread(fd, p, n, (off_t)pos);
+                if (got > 0) {
+                    pos += (uint64_t)got;
+                    for (ssize_t i = got; i > 0; i--)
+                        if (p[i - 1] == '\n') {
+                            lineEnd = pos - (uint64_t)(got - i);
+                            break;
+                        }
+                    return (size_t)got;
+                }
+                // A failed read, or a file cut short since the fstat
+                if (got == 0 || errno != EINTR) {
+                    failed = true;
+                    break;
+                }
+            }
+            return 0;
+        }, tail.offset == 0);
+        stats.swap(added);
+
+        auto t1 = Clock::now();
+        stats.mergeFrom(added);
+        lastIngest.mergeNs += nanos(Clock::now() - t1);
+        // A read that stopped early still counted the rows before it, the
+        // partial one included; the next call skips that line, as after an
+        // ingest.
+        tail.offset = lineEnd;
+        tail.counted = pos - lineEnd;
+        sourceKnown = false;
+        updateRankings(added);
+    }
+    ::close(fd);
+    if (failed) lastIngest.readErrors = 1;
+    lastIngest.ingestNs = nanos(Clock::now() - t0);
+    return !failed;
+}
+
+void TripAnalyzer::follow(const string& path, const function<bool(const IngestStats&)>& onUpdate,
+                          int pollMs) {
+    const uint32_t kEvents = IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+    int in = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    int wd = in >= 0 ? inotify_add_watch(in, path.c_str(), kEvents) : -1;
+
+    for (;;) {
+        appendFrom(path);
+        if (!onUpdate(ingestStats())) break;
+
+        if (wd < 0) {
+            // No inotify, or no file to watch yet: poll, and retry the watch.
+            this_thread::sleep_for(chrono::milliseconds(pollMs));
+            if (in >= 0) wd = inotify_add_watch(in, path.c_str(), kEvents);
+            continue;
+        }
+
+        // The timeout doubles as a poll in case an event was missed.
+        pollfd pfd{in, POLLIN, 0};
+        if (poll(&pfd, 1, pollMs) <= 0) continue;
+        alignas(inotify_event) char buf[4096];
+        bool moved = false;
+        ssize_t n;
+        while ((n = ::read(in, buf, sizeof(buf))) > 0) {
+            for (char* p = buf; p < buf + n;) {
+                const inotify_event* ev = (const inotify_event*)p;
+                if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) moved = true;
+                p += sizeof(inotify_event) + ev->len;
+            }
+        }
+        if (moved) {
+            // Rotated: watch whatever is at path now.
+            inotify_rm_watch(in, wd);
+            wd = inotify_add_watch(in, path.c_str(), kEvents);
+        }
+    }
+    if (in >= 0) ::close(in);
+}
+
+IngestStats TripAnalyzer::ingestStats() const {
+    lock_guard<mutex> lock(cacheLock.m);
+    IngestStats s = lastIngest;
+    s.rankNs = rankNs;
+    return s;
+}
+
+IngestStats& IngestStats::operator+=(const IngestStats& o) {
+    bytesRead += o.bytesRead;
+    rows += o.rows;
+    rowsAccepted += o.rowsAccepted;
+    blankLines += o.blankLines;
+    tooFewFields += o.tooFewFields;
+    emptyZone += o.emptyZone;
+    emptyTime += o.emptyTime;
+    badTime += o.badTime;
+    hourOutOfRange += o.hourOutOfRange;
+    undated += o.undated;
+    noDropoff += o.noDropoff;
+    badDistance += o.badDistance;
+    badFare += o.badFare;
+    filesRead += o.filesRead;
+    filesFailed += o.filesFailed;
+    readErrors += o.readErrors;
+    readNs += o.readNs;
+    parseNs += o.parseNs;
+    aggregateNs += o.aggregateNs;
+    mergeNs += o.mergeNs;
+    ingestNs += o.ingestNs;
+    rankNs += o.rankNs;
+    return *this;
+}
+
+void TripAnalyzer::merge(const TripAnalyzer& other) {
+    stats.mergeFrom(other.stats);
+    sourceKnown = false;
+    invalidateRankings();
+}
+
+void TripAnalyzer::invalidateRankings() {
+    zoneRank.clear();
+    slotRank.clear();
+    zoneRankComplete = false;
+    slotRankComplete = false;
+    hourPrefix.clear();
+    hourPrefix.shrink_to_fit();
+    cellsByDay.clear();
+    cellsByDay.shrink_to_fit();
+    routesByOrigin.clear();
+    routesByOrigin.shrink_to_fit();
+    rankNs = 0;
+}
+
+bool TripAnalyzer::zoneBefore(uint32_t a, uint32_t b) const {
+    long long ca = stats.zones.total(a), cb = stats.zones.total(b);
+    if (ca != cb) return ca > cb;
+    return stats.dict.name(a) < stats.dict.name(b);
+}
+
+bool TripAnalyzer::slotBefore(const SlotRef& a, const SlotRef& b) const {
+    if (a.count != b.count) return a.count > b.count;
+    if (a.zone != b.zone) return stats.dict.name(a.zone) < stats.dict.name(b.zone);
+    return a.hour < b.hour;
+}
+
+// Counts only grew, and only for the zones and slots in added. An untouched
+// entry outside a cached top-K prefix ranked below every entry in it and
+// still does, so the new top-K is the best K of the old prefix plus what
+// changed: untouched prefix entries keep their order and are merged with
+// the re-ranked changed ones. A complete ranking stays complete, since new
+// zones and slots are all among the changed ones. The other query indexes
+// are dropped and rebuilt by their next query.
+void TripAnalyzer::updateRankings(const ZoneTable& added) {
+    vector<uint32_t> zones = std::move(zoneRank);
+    vector<SlotRef> slots = std::move(slotRank);
+    bool zonesComplete = zoneRankComplete, slotsComplete = slotRankComplete;
+    long long ns = rankNs;
+    invalidateRankings();
+    rankNs = ns;
+    if (approximate() || (zones.empty() && slots.empty())) return;
+    ScopedTimer timer(rankNs);
+
+    vector<uint32_t> changedZones;
+    vector<SlotRef> changedSlots;
+    changedZones.reserve(added.zones.size());
+    for (uint32_t i = 0; i < added.zones.size(); i++) {
+        uint32_t id = stats.dict.find(added.dict.name(i));
+        changedZones.push_back(id);
+        added.zones.forEachHour(i, [&](int h, long long) {
+            changedSlots.push_back({id, (uint32_t)h, stats.zones.count(id, h)});
+        });
+    }
+
+    if (!zones.empty()) {
+        sort(changedZones.begin(), changedZones.end());
+        vector<uint32_t> kept;
+        for (uint32_t id : zones)
+            if (!binary_search(changedZones.begin(), changedZones.end(), id)) kept.push_back(id);
+        auto before = [this](uint32_t a, uint32_t b) { return zoneBefore(a, b); };
+        sort(changedZones.begin(), changedZones.end(), before);
+        zoneRank.resize(kept.size() + changedZones.size());
+        std::merge(kept.begin(), kept.end(), changedZones.begin(), changedZones.end(), zoneRank.begin(), before);
+        if (!zonesComplete && zoneRank.size() > zones.size()) zoneRank.resize(zones.size());
+        zoneRankComplete = zonesComplete;
+    }
+
+    if (!slots.empty()) {
+        auto key = [](const SlotRef& r) { return (uint64_t)r.zone << 5 | r.hour; };
+        vector<uint64_t> changedKeys;
+        changedKeys.reserve(changedSlots.size());
+        for (const SlotRef& r : changedSlots) changedKeys.push_back(key(r));
+        sort(changedKeys.begin(), changedKeys.end());
+        vector<SlotRef> kept;
+        for (const SlotRef& r : slots)
+            if (!binary_search(changedKeys.begin(), changedKeys.end(), key(r))) kept.push_back(r);
+        auto before = [this](const SlotRef& a, const SlotRef& b) { return slotBefore(a, b); };
+        sort(changedSlots.begin(), changedSlots.end(), before);
+        slotRank.resize(kept.size() + changedSlots.size());
+        std::merge(kept.begin(), kept.end(), changedSlots.begin(), changedSlots.end(), slotRank.begin(), before);
+        if (!slotsComplete && slotRank.size() > slots.size()) slotRank.resize(slots.size());
+        slotRankComplete = slotsComplete;
+    }
+}
+
+// Extends the cached prefix to at least k entries. Each rebuild at least
+// doubles it, so any sequence of queries rebuilds O(log m) times.
+const vector<uint32_t>& TripAnalyzer::rankedZones(size_t k) const {
+    if (zoneRankComplete || zoneRank.size() >= k) return zoneRank;
+    k = max(k, zoneRank.size() * 2);
+    ScopedTimer timer(rankNs);
+
+    // Rank ids, not strings: names are only touched to break count ties
+    // and for the rows returned.
+    auto before = [this](uint32_t a, uint32_t b) { return zoneBefore(a, b); };
+
+    uint32_t m = (uint32_t)stats.zones.size();
+    if (preferFullSort(k, m)) {
+        zoneRank.resize(m);
+        for (uint32_t i = 0; i < m; i++) zoneRank[i] = i;
+        sort(zoneRank.begin(), zoneRank.end(), before);
+        zoneRankComplete = true;
+    } else {
+        TopK<uint32_t, decltype(before)> top(k, before);
+        for (uint32_t i = 0; i < m; i++) top.push(i);
+        zoneRank = top.take();
+    }
+    return zoneRank;
+}
+
+const vector<TripAnalyzer::SlotRef>& TripAnalyzer::rankedSlots(size_t k) const {
+    if (slotRankComplete || slotRank.size() >= k) return slotRank;
+    k = max(k, slotRank.size() * 2);
+    ScopedTimer timer(rankNs);
+
+    auto before = [this](const SlotRef& a, const SlotRef& b) { return slotBefore(a, b); };
+
+    size_t m = 0;
+    for (uint32_t id = 0; id < stats.zones.size(); id++)
+        m += __builtin_popcount(stats.zones.hourMask(id));
+
+    if (preferFullSort(k, m)) {
+        slotRank.clear();
+        slotRank.reserve(m);
+        for (uint32_t id = 0; id < stats.zones.size(); id++) {
+            stats.zones.forEachHour(id, [&](int h, long long c) {
+                slotRank.push_back({id, (uint32_t)h, c});
+            });
+        }
+
+        sort(slotRank.begin(), slotRank.end(), before);
+        slotRankComplete = true;
+        return slotRank;
+    }
+
+    TopK<SlotRef, decltype(before)> top(k, before);
+    for (uint32_t id = 0; id < stats.zones.size(); id++) {
+        stats.zones.forEachHour(id, [&](int h, long long c) {
+            // Cheap reject on the count alone before the full comparison.
+            if (top.full() && c < top.worst().count) return;
+            top.push({id, (uint32_t)h, c});
+        });
+    }
+    slotRank = top.take();
+    return slotRank;
+}
+
+vector<ZoneCount> TripAnalyzer::topZones(int k) const {
+    if (approximate()) {
+        vector<ZoneCount> v;
+        for (ZoneEstimate& e : estimateTopZones(k)) v.push_back({std::move(e.zone), e.count});
+        return v;
+    }
+    if (k <= 0 || stats.zones.empty()) return {};
+
+    lock_guard<mutex> lock(cacheLock.m);
+    const vector<uint32_t>& ids = rankedZones(k);
+    size_t n = min(ids.size(), (size_t)k);
+
+    vector<ZoneCount> v;
+    v.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        v.push_back({stats.dict.name(ids[i]), stats.zones.total(ids[i])});
     return v;
 }
 
 vector<SlotCount> TripAnalyzer::topBusySlots(int k) const {
-    if (k <= 0 || stats.empty()) return {};
+    if (approximate()) {
+        vector<SlotCount> v;
+        for (SlotEstimate& e : estimateTopBusySlots(k))
+            v.push_back({std::move(e.zone), e.hour, e.count});
+        return v;
+    }
+    if (k <= 0 || stats.zones.empty()) return {};
+
+    lock_guard<mutex> lock(cacheLock.m);
+    const vector<SlotRef>& ranked = rankedSlots(k);
+    size_t n = min(ranked.size(), (size_t)k);
 
     vector<SlotCount> v;
-    v.reserve(stats.size() * 4);
+    v.reserve(n);
+    for (size_t i = 0; i < n; i++)
+        v.push_back({stats.dict.name(ranked[i].zone), (int)ranked[i].hour, ranked[i].count});
+    return v;
+}
+
+long long TripAnalyzer::zoneCount(const string& zone) const {
+    if (approximate()) {
+        const SpaceSaving::Entry* e = stats.zoneSketch.find(zone);
+        return e ? (long long)e->count : 0;
+    }
+    uint32_t id = stats.dict.find(zone);
+    return id == ZoneDictionary::npos ? 0 : stats.zones.total(id);
+}
+
+long long TripAnalyzer::slotCount(const string& zone, int hour) const {
+    if (hour < 0 || hour > 23) return 0;
+    if (approximate()) {
+        string key = zone;
+        key.push_back((char)hour);
+        const SpaceSaving::Entry* e = stats.slotSketch.find(key);
+        return e ? (long long)e->count : 0;
+    }
+    uint32_t id = stats.dict.find(zone);
+    return id == ZoneDictionary::npos ? 0 : stats.zones.count(id, hour);
+}
+
+vector<ZoneEstimate> TripAnalyzer::estimateTopZones(int k) const {
+    if (!approximate()) {
+        vector<ZoneEstimate> v;
+        for (ZoneCount& z : topZones(k)) v.push_back({std::move(z.zone), z.count, 0});
+        return v;
+    }
+    if (k <= 0) return {};
+
+    lock_guard<mutex> lock(cacheLock.m);
+    ScopedTimer timer(rankNs);
+    using Entry = SpaceSaving::Entry;
+    auto before = [](const Entry* a, const Entry* b) {
+        if (a->count != b->count) return a->count > b->count;
+        return a->key < b->key;
+    };
+    TopK<const Entry*, decltype(before)> top(k, before);
+    for (const Entry& e : stats.zoneSketch.items()) top.push(&e);
 
-    for (const auto& kv : stats) {
-        const string& z = kv.first;
-        const ZoneStats& zs = kv.second;
-        for (int h = 0; h < 24; h++) {
-            if (zs.byHour[h] > 0)
-                v.push_back({z, h, zs.byHour[h]});
+    vector<ZoneEstimate> v;
+    for (const Entry* e : top.take())
+        v.push_back({e->key, (long long)e->count, (long long)e->error});
+    return v;
+}
+
+vector<SlotEstimate> TripAnalyzer::estimateTopBusySlots(int k) const {
+    if (!approximate()) {
+        vector<SlotEstimate> v;
+        for (SlotCount& s : topBusySlots(k)) v.push_back({std::move(s.zone), s.hour, s.count, 0});
+        return v;
+    }
+    if (k <= 0) return {};
+
+    // Slot keys are the zone followed by one hour byte.
+    lock_guard<mutex> lock(cacheLock.m);
+    ScopedTimer timer(rankNs);
+    using Entry = SpaceSaving::Entry;
+    auto zoneOf = [](const Entry* e) { return string_view(e->key).substr(0, e->key.size() - 1); };
+    auto before = [&](const Entry* a, const Entry* b) {
+        if (a->count != b->count) return a->count > b->count;
+        if (zoneOf(a) != zoneOf(b)) return zoneOf(a) < zoneOf(b);
+        return a->key.back() < b->key.back();
+    };
+    TopK<const Entry*, decltype(before)> top(k, before);
+    for (const Entry& e : stats.slotSketch.items()) top.push(&e);
+
+    vector<SlotEstimate> v;
+    for (const Entry* e : top.take())
+        v.push_back({string(zoneOf(e)), (int)e->key.back(), (long long)e->count,
+                     (long long)e->error});
+    return v;
+}
+
+long long TripAnalyzer::windowCount(uint32_t id, int hourFrom, int hourTo) const {
+    const long long* p = &hourPrefix[(size_t)id * 25];
+    if (hourFrom <= hourTo) return p[hourTo + 1] - p[hourFrom];
+    return p[24] - (p[hourFrom] - p[hourTo + 1]);
+}
+
+vector<ZoneCount> TripAnalyzer::topZones(int k, int hourFrom, int hourTo) const {
+    if (k <= 0 || stats.zones.empty()) return {};
+    if (hourFrom < 0 || hourFrom > 23 || hourTo < 0 || hourTo > 23) return {};
+
+    lock_guard<mutex> lock(cacheLock.m);
+    if (hourPrefix.empty()) {
+        ScopedTimer timer(rankNs);
+        hourPrefix.resize(stats.zones.size() * 25);
+        for (size_t id = 0; id < stats.zones.size(); id++) {
+            long long* p = &hourPrefix[id * 25];
+            p[0] = 0;
+            for (int h = 0; h < 24; h++) p[h + 1] = p[h] + stats.zones.count((uint32_t)id, h);
         }
     }
 
-    sort(v.begin(), v.end(), [](const SlotCount& a, const SlotCount& b) {
+    ScopedTimer timer(rankNs);
+    vector<pair<long long, uint32_t>> cand;     // (window count, zone id)
+    auto before = [this](const pair<long long, uint32_t>& a, const pair<long long, uint32_t>& b) {
+        if (a.first != b.first) return a.first > b.first;
+        return stats.dict.name(a.second) < stats.dict.name(b.second);
+    };
+
+    uint32_t m = (uint32_t)stats.zones.size();
+    if (preferFullSort(k, m)) {
+        for (uint32_t id = 0; id < m; id++) {
+            long long c = windowCount(id, hourFrom, hourTo);
+            if (c > 0) cand.push_back({c, id});
+        }
+        sort(cand.begin(), cand.end(), before);
+        if (cand.size() > (size_t)k) cand.resize(k);
+    } else {
+        TopK<pair<long long, uint32_t>, decltype(before)> top(k, before);
+        for (uint32_t id = 0; id < m; id++) {
+            long long c = windowCount(id, hourFrom, hourTo);
+            if (c == 0 || (top.full() && c < top.worst().first)) continue;
+            top.push({c, id});
+        }
+        cand = top.take();
+    }
+
+    vector<ZoneCount> v;
+    v.reserve(cand.size());
+    for (const auto& c : cand) v.push_back({stats.dict.name(c.second), c.first});
+    return v;
+}
+
+bool TripAnalyzer::dayRange(const string& fromDate, const string& toDate,
+                            const CountTable::Cell*& b, const CountTable::Cell*& e) const {
+    int32_t from, to;
+    if (stats.dayCells.empty() || !parseDay(fromDate, from) || !parseDay(toDate, to) || from > to)
+        return false;
+
+    if (cellsByDay.empty()) {
+        ScopedTimer timer(rankNs);
+        cellsByDay.reserve(stats.dayCells.size());
+        stats.dayCells.forEach([this](uint64_t key, uint64_t count) {
+            cellsByDay.push_back({key, count});
+        });
+        sort(cellsByDay.begin(), cellsByDay.end(),
+             [](const CountTable::Cell& x, const CountTable::Cell& y) {
+                 int32_t dx = cellDay(x.key), dy = cellDay(y.key);
+                 return dx != dy ? dx < dy : x.key < y.key;
+             });
+    }
+
+    const CountTable::Cell* all = cellsByDay.data();
+    const CountTable::Cell* end = all + cellsByDay.size();
+    b = lower_bound(all, end, from, [](const CountTable::Cell& c, int32_t d) { return cellDay(c.key) < d; });
+    e = upper_bound(b, end, to, [](int32_t d, const CountTable::Cell& c) { return d < cellDay(c.key); });
+    return b != e;
+}
+
+vector<ZoneCount> TripAnalyzer::topZonesInDates(int k, const string& fromDate,
+                                                const string& toDate) const {
+    if (k <= 0) return {};
+    lock_guard<mutex> lock(cacheLock.m);
+    const CountTable::Cell *b, *e;
+    if (!dayRange(fromDate, toDate, b, e)) return {};
+
+    ScopedTimer timer(rankNs);
+    vector<long long> perZone(stats.zones.size(), 0);
+    for (const CountTable::Cell* c = b; c != e; c++) perZone[cellZone(c->key)] += c->count;
+
+    auto before = [&](uint32_t a, uint32_t b) {
+        if (perZone[a] != perZone[b]) return perZone[a] > perZone[b];
+        return stats.dict.name(a) < stats.dict.name(b);
+    };
+    TopK<uint32_t, decltype(before)> top(k, before);
+    for (uint32_t id = 0; id < perZone.size(); id++)
+        if (perZone[id] > 0) top.push(id);
+
+    vector<ZoneCount> v;
+    for (uint32_t id : top.take()) v.push_back({stats.dict.name(id), perZone[id]});
+    return v;
+}
+
+vector<SlotCount> TripAnalyzer::topBusySlotsInDates(int k, const string& fromDate,
+                                                    const string& toDate) const {
+    if (k <= 0) return {};
+    lock_guard<mutex> lock(cacheLock.m);
+    const CountTable::Cell *b, *e;
+    if (!dayRange(fromDate, toDate, b, e)) return {};
+
+    // Fold the days away: (zone, hour) slots keyed like cells of day 0.
+    ScopedTimer timer(rankNs);
+    CountTable slots;
+    for (const CountTable::Cell* c = b; c != e; c++)
+        slots.add(cellKey(cellZone(c->key), 0, cellHour(c->key)), c->count);
+
+    auto before = [this](const SlotRef& a, const SlotRef& b) { return slotBefore(a, b); };
+    TopK<SlotRef, decltype(before)> top(k, before);
+    slots.forEach([&](uint64_t key, uint64_t count) {
+        top.push({cellZone(key), (uint32_t)cellHour(key), (long long)count});
+    });
+
+    vector<SlotCount> v;
+    for (const SlotRef& r : top.take()) v.push_back({stats.dict.name(r.zone), (int)r.hour, r.count});
+    return v;
+}
+
+vector<RouteCount> TripAnalyzer::topRoutes(int k) const {
+    if (k <= 0 || stats.routes.empty()) return {};
+
+    lock_guard<mutex> lock(cacheLock.m);
+    ScopedTimer timer(rankNs);
+    auto before = [this](const CountTable::Cell& a, const CountTable::Cell& b) {
         if (a.count != b.count) return a.count > b.count;
-        if (a.zone != b.zone) return a.zone < b.zone;
-        return a.hour < b.hour;
+        uint32_t fa = routeFrom(a.key), fb = routeFrom(b.key);
+        if (fa != fb) return stats.dict.name(fa) < stats.dict.name(fb);
+        return stats.dropoffs.name(routeTo(a.key)) < stats.dropoffs.name(routeTo(b.key));
+    };
+    TopK<CountTable::Cell, decltype(before)> top(k, before);
+    stats.routes.forEach([&](uint64_t key, uint64_t count) {
+        if (top.full() && count < top.worst().count) return;
+        top.push({key, count});
     });
 
-    if ((int)v.size() > k) v.resize(k);
+    vector<RouteCount> v;
+    for (const CountTable::Cell& c : top.take())
+        v.push_back({stats.dict.name(routeFrom(c.key)), stats.dropoffs.name(routeTo(c.key)),
+                     (long long)c.count});
+    return v;
+}
+
+vector<ZoneCount> TripAnalyzer::topDestinations(const string& zone, int k) const {
+    if (k <= 0 || stats.routes.empty()) return {};
+    uint32_t from = stats.dict.find(zone);
+    if (from == ZoneDictionary::npos) return {};
+
+    lock_guard<mutex> lock(cacheLock.m);
+    ScopedTimer timer(rankNs);
+    if (routesByOrigin.empty()) {
+        routesByOrigin.reserve(stats.routes.size());
+        stats.routes.forEach([this](uint64_t key, uint64_t count) {
+            routesByOrigin.push_back({key, count});
+        });
+        sort(routesByOrigin.begin(), routesByOrigin.end(),
+             [](const CountTable::Cell& x, const CountTable::Cell& y) { return x.key < y.key; });
+    }
+
+    auto byKey = [](const CountTable::Cell& c, uint64_t key) { return c.key < key; };
+    auto b = lower_bound(routesByOrigin.begin(), routesByOrigin.end(), routeKey(from, 0), byKey);
+    auto e = lower_bound(b, routesByOrigin.end(), routeKey(from, 0) + (1ULL << 32), byKey);
+
+    auto before = [this](const CountTable::Cell& a, const CountTable::Cell& b) {
+        if (a.count != b.count) return a.count > b.count;
+        return stats.dropoffs.name(routeTo(a.key)) < stats.dropoffs.name(routeTo(b.key));
+    };
+    TopK<CountTable::Cell, decltype(before)> top(k, before);
+    for (auto it = b; it != e; ++it) top.push(*it);
+
+    vector<ZoneCount> v;
+    for (const CountTable::Cell& c : top.take())
+        v.push_back({stats.dropoffs.name(routeTo(c.key)), (long long)c.count});
+    return v;
+}
+
+TripMetrics TripAnalyzer::slotMetrics(const string& zone, int hour) const {
+    TripMetrics tm;
+    uint32_t id = stats.dict.find(zone);
+    if (id == ZoneDictionary::npos || hour < 0 || hour > 23) return tm;
+
+    if (const SlotMetrics* m = stats.findMetrics(id, hour)) {
+        tm.fare = m->fare;
+        tm.distance = m->distance;
+    }
+    return tm;
+}
+
+TripMetrics TripAnalyzer::zoneMetrics(const string& zone) const {
+    TripMetrics tm;
+    uint32_t id = stats.dict.find(zone);
+    if (id == ZoneDictionary::npos || stats.metrics.empty()) return tm;
+
+    stats.zones.forEachHour(id, [&](int h, long long) {
+        if (const SlotMetrics* m = stats.findMetrics(id, h)) {
+            tm.fare += m->fare;
+            tm.distance += m->distance;
+        }
+    });
+    return tm;
+}
+
+vector<ZoneCount> TripAnalyzer::topZonesByRevenue(int k) const {
+    if (k <= 0 || stats.metrics.empty()) return {};
+
+    lock_guard<mutex> lock(cacheLock.m);
+    ScopedTimer timer(rankNs);
+    auto before = [this](const pair<long long, uint32_t>& a, const pair<long long, uint32_t>& b) {
+        if (a.first != b.first) return a.first > b.first;
+        return stats.dict.name(a.second) < stats.dict.name(b.second);
+    };
+    vector<long long> cents(stats.zones.size(), 0), fares(stats.zones.size(), 0);
+    stats.metricIndex.forEach([&](uint64_t key, uint64_t i) {
+        const MetricSummary& f = stats.metrics[i - 1].fare;
+        cents[cellZone(key)] += f.sum;
+        fares[cellZone(key)] += f.n;
+    });
+    TopK<pair<long long, uint32_t>, decltype(before)> top(k, before);
+    for (uint32_t id = 0; id < cents.size(); id++)
+        if (fares[id] > 0) top.push({cents[id], id});
+
+    vector<ZoneCount> v;
+    for (const auto& c : top.take()) v.push_back({stats.dict.name(c.second), c.first});
+    return v;
+}
+
+vector<SlotCount> TripAnalyzer::topBusySlotsByRevenue(int k) const {
+    if (k <= 0 || stats.metrics.empty()) return {};
+
+    lock_guard<mutex> lock(cacheLock.m);
+    ScopedTimer timer(rankNs);
+    auto before = [this](const SlotRef& a, const SlotRef& b) { return slotBefore(a, b); };
+    TopK<SlotRef, decltype(before)> top(k, before);
+    stats.metricIndex.forEach([&](uint64_t key, uint64_t i) {
+        const MetricSummary& f = stats.metrics[i - 1].fare;
+        if (f.n > 0) top.push({cellZone(key), (uint32_t)cellHour(key), f.sum});
+    });
+
+    vector<SlotCount> v;
+    for (const SlotRef& r : top.take()) v.push_back({stats.dict.name(r.zone), (int)r.hour, r.count});
     return v;
 }
@@ -1,10 +1,22 @@
 #pragma once
+#include <climits>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <istream>
+#include <functional>
+#include <mutex>
 #include <unordered_map>
+#include "zone_dict.h"
+#include "mapped_file.h"
+#include "count_table.h"
+#include "hour_counts.h"
+#include "space_saving.h"
 
 using namespace std;
 
+struct CsvRow;
+
 struct ZoneCount {
     string zone;
     long long count;
@@ -16,23 +28,427 @@ struct SlotCount {
     long long count;
 };
 
+struct RouteCount {
+    string from;    // pickup zone
+    string to;      // dropoff zone
+    long long count;
+};
+
+// An approximate count: the true count lies in [count - error, count].
+// Exact results have error 0.
+struct ZoneEstimate {
+    string zone;
+    long long count;
+    long long error;
+};
+
+struct SlotEstimate {
+    string zone;
+    int hour;
+    long long count;
+    long long error;
+};
+
+// Count, sum and extremes of one trip metric over the trips that carried a
+// valid value. Fares are in cents, distances in tenths of a km; min and max
+// are meaningful only when n > 0.
+struct MetricSummary {
+    long long n = 0;
+    long long sum = 0;
+    long long min = 0;
+    long long max = 0;
+
+    void add(long long v);
+    MetricSummary& operator+=(const MetricSummary& o);
+    double mean() const { return n ? (double)sum / n : 0.0; }
+};
+
+struct TripMetrics {
+    MetricSummary fare;
+    MetricSummary distance;
+};
+
+// What the last ingest read, accepted and rejected, and where its time
+// went. Every data line (header excluded) lands in exactly one of
+// rowsAccepted, blankLines or a reject counter. With several parser
+// threads parseNs and aggregateNs are summed over threads; ingestNs is the
+// wall time of the whole call. rankNs accumulates ranking work done by
+// queries since the ingest.
+struct IngestStats {
+    unsigned long long bytesRead = 0;
+    unsigned long long rows = 0;
+    unsigned long long rowsAccepted = 0;
+    unsigned long long blankLines = 0;
+    unsigned long long tooFewFields = 0;
+    unsigned long long emptyZone = 0;
+    unsigned long long emptyTime = 0;
+    unsigned long long badTime = 0;         // no parsable hour
+    unsigned long long hourOutOfRange = 0;
+    unsigned long long undated = 0;         // accepted, but no YYYY-MM-DD (trackDates)
+    unsigned long long noDropoff = 0;       // accepted, but empty dropoff zone (trackRoutes)
+    unsigned long long badDistance = 0;     // accepted, but no parsable distance (trackMetrics)
+    unsigned long long badFare = 0;         // accepted, but no parsable fare (trackMetrics)
+    unsigned long long filesRead = 0;
+    unsigned long long filesFailed = 0;     // could not be opened
+    unsigned long long readErrors = 0;      // inputs cut short by a failed read
+
+    long long readNs = 0;       // stat + mmap, or stream reads
+    long long parseNs = 0;      // row splitting and field parsing
+    long long aggregateNs = 0;  // zone lookups and counter updates
+    long long mergeNs = 0;      // folding per-thread tables together
+    long long ingestNs = 0;
+    long long rankNs = 0;
+
+    IngestStats& operator+=(const IngestStats& o);
+};
+
+// Knobs for ingestFile. The defaults give the fastest path; every
+// combination produces the same counts, except that approximate estimates
+// depend on row order and thread count (their error bounds always hold).
+struct IngestOptions {
+    bool useMmap = true;    // parse the file in place; falls back to streaming
+    int threads = 1;        // parser threads, 0 = all cores
+    bool trackDates = false; // also count zone x day x hour cells
+    bool trackRoutes = false; // also count pickup -> dropoff zone pairs
+    bool trackMetrics = false; // also sum fare and distance per (zone, hour)
+    size_t approxEntries = 0;  // > 0: keep only this many zones and as many
+                               // slots in Space-Saving summaries; 0 = exact
+};
+
 class TripAnalyzer {
 public:
     void ingestFile(const string& csvPath);
+
+    // Same parsing and counts as ingestFile, for input that is not a regular
+    // file (pipes, sockets, decompressor output). Data is read in 1 MiB
+    // blocks and parsed in place, lines spanning blocks included. ingestFd
+    // reads until EOF and does not close fd. A failed read ends the input
+    // there: the rows before it are kept, IngestStats::readErrors counts
+    // it, and ingestFd returns false. Snapshots of the result skip
+    // the source check. With more than one thread, the calling thread only
+    // reads and the blocks are parsed by worker threads meanwhile; an
+    // unmapped ingestFile goes the same way.
+    void ingestStream(istream& in);
+    bool ingestFd(int fd);
+
+    // Ingests several files into one result, replacing the current counts
+    // as ingestFile does. Each file is parsed whole by one worker, largest
+    // files first, with up to IngestOptions::threads files in flight; a
+    // header is skipped per file and unreadable files are only counted.
+    // ingestDirectory takes the regular files in dir whose names match the
+    // glob pattern, not recursing. Snapshots of more than one file skip
+    // the source check.
+    void ingestFiles(const vector<string>& paths);
+    void ingestDirectory(const string& dir, const string& pattern = "*.csv");
+
+    // Adds the complete lines written to path since it was last read by
+    // appendFrom, ingestFile, ingestFiles or ingestDirectory, keeping the
+    // current counts; a partial last line waits for its newline. A path not
+    // read before is read from byte 0, header included, and so is a file
+    // that shrank or was replaced (new inode), as log rotation does.
+    // ingestStats() then describes this append alone. Returns false if path
+    // cannot be opened, or if a read fails partway: the rows before the
+    // failure are kept, IngestStats::readErrors counts it, and the next call
+    // carries on from the last line it read. Every call that replaces the counts forgets the
+    // remembered offsets of other files. A last line that an ingest counted
+    // before its newline arrived is not counted again when it does.
+    //
+    // The work is in the new bytes: the cached topZones / topBusySlots
+    // prefixes are patched with the zones and slots the append touched.
+    // Window, date and route queries rebuild their indexes afterwards.
+    bool appendFrom(const string& path);
+
+    // Keeps appending from path as it grows: waits for inotify events, or
+    // re-checks every pollMs where inotify is unavailable or misses a
+    // rotation. onUpdate runs after every check, with the stats of what
+    // was added (rows == 0 if nothing), and returning false stops.
+    void follow(const string& path, const function<bool(const IngestStats&)>& onUpdate,
+                int pollMs = 500);
+
+    // The queries below, ingestStats, saveSnapshot and being merged from
+    // are const and may run on several threads at once: the rankings and
+    // indexes they build on first use are guarded by a mutex. Anything
+    // that changes the counts (ingest*, appendFrom, follow, merge,
+    // loadSnapshot, setOptions) needs the analyzer to itself.
     vector<ZoneCount> topZones(int k = 10) const;
     vector<SlotCount> topBusySlots(int k = 10) const;
 
+    // Trips picked up in zone, in all or in one hour; 0 for an unknown
+    // zone or an hour outside 0..23. An approximate analyzer returns the
+    // estimate for a kept key and 0 otherwise.
+    long long zoneCount(const string& zone) const;
+    long long slotCount(const string& zone, int hour) const;
+
+    // Top zones by trips whose pickup hour lies in [hourFrom, hourTo]; a
+    // window with hourFrom > hourTo wraps past midnight (22..2). Zones with
+    // no trips in the window are left out; hours outside 0..23 give {}.
+    // Each zone's window total is O(1) from cached per-zone prefix sums.
+    vector<ZoneCount> topZones(int k, int hourFrom, int hourTo) const;
+
+    // Date-range variants over the zone x day x hour cells kept when
+    // IngestOptions::trackDates is on. Dates are "YYYY-MM-DD", inclusive;
+    // the result is empty if dates were not tracked or a date is invalid.
+    vector<ZoneCount> topZonesInDates(int k, const string& fromDate, const string& toDate) const;
+    vector<SlotCount> topBusySlotsInDates(int k, const string& fromDate, const string& toDate) const;
+
+    // Origin-destination queries over the pairs kept when
+    // IngestOptions::trackRoutes is on. topRoutes ranks pairs by count, then
+    // pickup zone, then dropoff zone; topDestinations ranks the dropoff
+    // zones of trips picked up in zone. Empty if routes were not tracked.
+    vector<RouteCount> topRoutes(int k = 10) const;
+    vector<ZoneCount> topDestinations(const string& zone, int k = 10) const;
+
+    // Fare and distance summaries kept when IngestOptions::trackMetrics is
+    // on; all zeros for an unknown zone or hour, or if metrics were not
+    // tracked. A zone's summary folds its 24 hourly ones.
+    TripMetrics zoneMetrics(const string& zone) const;
+    TripMetrics slotMetrics(const string& zone, int hour) const;
+
+    // Revenue rankings: count holds the fare sum in cents, ties break as in
+    // topZones and topBusySlots. Zones and slots without a fare are left out.
+    vector<ZoneCount> topZonesByRevenue(int k = 10) const;
+    vector<SlotCount> topBusySlotsByRevenue(int k = 10) const;
+
+    // Top zones and slots with error bounds. After an exact ingest these are
+    // topZones / topBusySlots with error 0. With IngestOptions::approxEntries
+    // the analyzer keeps only bounded summaries: these return the kept keys
+    // by estimated count, topZones and topBusySlots return the same
+    // estimates without the error, and the other queries are empty. Any
+    // zone with more than 1/approxEntries of all trips is always kept.
+    vector<ZoneEstimate> estimateTopZones(int k = 10) const;
+    vector<SlotEstimate> estimateTopBusySlots(int k = 10) const;
+    bool approximate() const { return stats.zoneSketch.capacity() != 0; }
+
+    // Binary snapshot of the aggregated counts (format in snapshot.cpp).
+    // loadSnapshot returns false and leaves the analyzer untouched when the
+    // snapshot is missing or corrupt, or when csvPath no longer has the size
+    // and mtime recorded at ingest. An empty csvPath skips that check.
+    // Approximate summaries are not snapshotted; saveSnapshot returns false.
+    bool saveSnapshot(const string& path) const;
+    bool loadSnapshot(const string& path, const string& csvPath);
+
+    // Adds another analyzer's (or snapshot's) per-zone and per-hour counts
+    // to this one, for reducing sharded runs. Merging is associative and
+    // commutative in everything the queries return. The result no longer
+    // stands for a single source file, so its snapshots skip the source check.
+    // If either side is approximate the result is, with the bounds summed.
+    void merge(const TripAnalyzer& other);
+    bool mergeSnapshot(const string& path);
+
+    IngestStats ingestStats() const;
+
+    void setOptions(const IngestOptions& o) { opts = o; }
+    const IngestOptions& options() const { return opts; }
+
 private:
-    struct ZoneStats {
-        long long total = 0;
-        long long byHour[24] = {0};
+    struct SlotMetrics {
+        MetricSummary fare;
+        MetricSummary distance;
+    };
+
+    static const long long kNoValue = LLONG_MIN;
+
+    // One accepted row as aggregated. Parts whose option is off keep their
+    // "absent" value.
+    struct Trip {
+        string_view zone;
+        string_view dropoff;            // empty: no route
+        int hour = 0;
+        int32_t day = -1;               // -1: undated
+        long long fare = kNoValue;      // cents
+        long long distance = kNoValue;  // tenths of a km
+    };
+
+    // Aggregation target: the analyzer's own table, or a worker's local
+    // table during parallel ingestion. zones holds the counts of dict's ids.
+    // dayCells is keyed by cellKey() and only filled for dated rows.
+    // Dropoff zones get their own dictionary, so a zone that is only ever
+    // a destination never shows up in the pickup rankings; routes is keyed
+    // by routeKey(pickup id, dropoff id). Metrics are kept only for the
+    // slots that have had a trip with a fare or distance: metricIndex maps
+    // cellKey(id, 0, hour) to 1 + the slot's position in metrics.
+    // When the sketches have a capacity the table is approximate: add()
+    // feeds only them, keyed by zone and by zone + one hour byte, and
+    // everything else stays empty.
+    struct ZoneTable {
+        ZoneDictionary dict;
+        HourCounts zones;
+        CountTable dayCells;
+        ZoneDictionary dropoffs;
+        CountTable routes;
+        CountTable metricIndex;
+        vector<SlotMetrics> metrics;
+        SpaceSaving zoneSketch;
+        SpaceSaving slotSketch;
+        string slotKey;         // scratch for slot sketch keys
+
+        void setApprox(size_t entries) {
+            zoneSketch.reset(entries);
+            slotSketch.reset(entries);
+        }
+        void add(const Trip& t);
+        void mergeFrom(const ZoneTable& other);
+        void mergeApprox(const ZoneTable& other);
+        void addExact(const ZoneTable& exact);
+        SlotMetrics& metricsAt(uint32_t id, int hour);
+        const SlotMetrics* findMetrics(uint32_t id, int hour) const {
+            uint64_t i = metricIndex.get(cellKey(id, 0, hour));
+            return i ? &metrics[i - 1] : nullptr;
+        }
+        void clear() {
+            dict.clear();
+            zones.clear();
+            dayCells.clear();
+            dropoffs.clear();
+            routes.clear();
+            metricIndex.clear();
+            metrics.clear();
+            zoneSketch.clear();
+            slotSketch.clear();
+        }
+        void swap(ZoneTable& other) {
+            dict.swap(other.dict);
+            zones.swap(other.zones);
+            dayCells.swap(other.dayCells);
+            dropoffs.swap(other.dropoffs);
+            routes.swap(other.routes);
+            metricIndex.swap(other.metricIndex);
+            metrics.swap(other.metrics);
+            zoneSketch.swap(other.zoneSketch);
+            slotSketch.swap(other.slotSketch);
+        }
+    };
+
+    // Cell key: zone id (32 bits) | days since 1970-01-01 (27) | hour (5).
+    static uint64_t cellKey(uint32_t zone, int32_t day, int hour) {
+        return (uint64_t)zone << 32 | (uint64_t)day << 5 | (uint64_t)hour;
+    }
+    static uint32_t cellZone(uint64_t key) { return (uint32_t)(key >> 32); }
+    static int32_t cellDay(uint64_t key) { return (int32_t)((key >> 5) & ((1u << 27) - 1)); }
+    static int cellHour(uint64_t key) { return (int)(key & 31); }
+
+    // Route key: pickup zone id (32 bits) | dropoff zone id (32), so keys
+    // sorted ascending group each origin's destinations together.
+    static uint64_t routeKey(uint32_t from, uint32_t to) { return (uint64_t)from << 32 | to; }
+    static uint32_t routeFrom(uint64_t key) { return (uint32_t)(key >> 32); }
+    static uint32_t routeTo(uint64_t key) { return (uint32_t)key; }
+
+    // A ranked (zone, hour) slot; the zone string is looked up only for
+    // slots that are returned.
+    struct SlotRef {
+        uint32_t zone;
+        uint32_t hour;
+        long long count;
     };
 
-    unordered_map<string, ZoneStats> stats;
+    ZoneTable stats;
+    IngestOptions opts;
+    FileStamp source;           // the ingested file as it was when read
+    bool sourceKnown = false;
+    IngestStats lastIngest;
+    mutable long long rankNs = 0;
+
+    // Held by const queries while they build or read the lazily built
+    // caches below, and rankNs. Copies and moves get a mutex of their own.
+    struct CacheLock {
+        mutable mutex m;
+        CacheLock() {}
+        CacheLock(const CacheLock&) {}
+        CacheLock& operator=(const CacheLock&) { return *this; }
+    };
+    CacheLock cacheLock;
+
+    // How far appendFrom has read a file, and which file that was.
+    struct Tail {
+        uint64_t dev = 0, ino = 0;
+        uint64_t offset = 0;    // just past the last consumed '\n'
+        uint64_t counted = 0;   // bytes after offset already counted as a
+                                // last row that had no newline yet
+    };
+    unordered_map<string, Tail> tails;
+
+    // Outcome of parsing one line, in the order the checks run.
+    enum RowStatus {
+        RowOk,
+        RowBlank,
+        RowTooFewFields,
+        RowEmptyZone,
+        RowEmptyTime,
+        RowBadTime,
+        RowHourRange,
+        RowStatusCount
+    };
+
+    // Best-first prefixes of the zone and slot rankings, built on the first
+    // query and grown on demand; a query for k <= the cached length is a
+    // slice. Ingestion resets these; appendFrom patches them in place.
+    mutable vector<uint32_t> zoneRank;
+    mutable vector<SlotRef> slotRank;
+    mutable bool zoneRankComplete = false;
+    mutable bool slotRankComplete = false;
+
+    static bool readSnapshot(const string& path, ZoneTable& into,
+                             FileStamp& src, bool& srcKnown);
+
+    // hourPrefix[id * 25 + h] = trips of zone id before hour h; built by
+    // the first window query, dropped with the rankings.
+    mutable vector<long long> hourPrefix;
+
+    // dayCells sorted by (day, zone, hour), so a date range is one
+    // contiguous run; built by the first date query.
+    mutable vector<CountTable::Cell> cellsByDay;
+
+    // routes sorted by key, so one origin's pairs are a contiguous run;
+    // built by the first topDestinations query.
+    mutable vector<CountTable::Cell> routesByOrigin;
+
+    bool dayRange(const string& fromDate, const string& toDate,
+                  const CountTable::Cell*& b, const CountTable::Cell*& e) const;
+
+    long long windowCount(uint32_t id, int hourFrom, int hourTo) const;
+
+    void invalidateRankings();
+    void updateRankings(const ZoneTable& added);
+    bool zoneBefore(uint32_t a, uint32_t b) const;
+    bool slotBefore(const SlotRef& a, const SlotRef& b) const;
+    const vector<uint32_t>& rankedZones(size_t k) const;
+    const vector<SlotRef>& rankedSlots(size_t k) const;
+
+    static string_view trim(string_view s);
+    static RowStatus parseHour(string_view dtRaw, int& hourOut);
+    static bool isHeader(string_view line);
+
+    static bool parseDay(string_view dtRaw, int32_t& dayOut);
+
+    // Fields of one row, as far as parsing got. Only zone and dt are
+    // guaranteed trimmed.
+    struct RowFields {
+        string_view zone, dropoff, dt, distance, fare;
+        int hour = 0;
+    };
+
+    static bool parseFixed(string_view s, int decimals, long long& out);
+    static Trip makeTrip(const RowFields& f, const IngestOptions& o, IngestStats& st);
+    static RowStatus parseRow(const CsvRow& row, RowFields& f);
+    static void countRows(const unsigned long long (&counts)[RowStatusCount], IngestStats& st);
+    static void ingestRange(const char* b, const char* e, const IngestOptions& o,
+                            ZoneTable& into, IngestStats& st);
+
+    static const char* skipHeader(const char* p, const char* end);
+
+    class BlockSource;      // cuts a byte stream into blocks of whole lines
 
-    static string trim(const string& s);
-    static bool split6(const string& line, string out[6]);
-    static bool parseHour(const string& dtRaw, int& hourOut);
+    static void ingestSerial(BlockSource& src, const IngestOptions& o, ZoneTable& into,
+                             IngestStats& st);
+    static bool ingestPath(const string& path, const IngestOptions& o, ZoneTable& into,
+                           IngestStats& st);
 
-    void processLine(const string& line);
+    int threadCount() const;
+    int workerCount(size_t bytes) const;
+    void mergeWorkers(vector<ZoneTable>& local, const vector<IngestStats>& localStats);
+    void ingestBuffer(const char* data, size_t size);     // header already skipped
+    void beginIngest();
+    void ingestBlocks(const function<size_t(char*, size_t)>& read, bool atFileStart = true);
+    void rememberTail(const string& path, uint64_t size);
+    void ingestPipelined(BlockSource& src, int workers);
 };
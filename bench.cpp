@@ -0,0 +1,125 @@
+// Ingest/query benchmark over synthetic trip files.
+//
+//   ./trip_bench [--rows N] [--threads T] [--reps R] [--profile NAME]
+//
+// For each profile a CSV is generated once into the working directory,
+// then ingestFile, the first topZones(10) and the first topBusySlots(10)
+// are timed separately (best of R runs, fresh analyzer per run). The first
+// line names the CSV block scanner the CPU dispatch picked.
+
+#include "analyzer.h"
+#include "csv_scan.h"
+#include "trip_gen.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+struct Profile {
+    const char* name;
+    const char* about;
+    long long zones;      // distinct zones; 0 = one per row
+    double zipf;          // 0 = uniform
+    double hotShare;      // share of rows on ZONE_HOT
+    double dirtyShare;    // share of malformed rows
+};
+
+static const Profile kProfiles[] = {
+    {"uniform", "1000 zones, uniform",                 1000,   0.0, 0.0, 0.0},
+    {"zipf",    "100k zones, zipf s=1.1",              100000, 1.1, 0.0, 0.0},
+    {"hot",     "one hot zone (C1 style), 10 others",  10,     0.0, 0.9, 0.0},
+    {"unique",  "every row a new zone (C2 style)",     0,      0.0, 0.0, 0.0},
+    {"dirty",   "1000 zones, 40% malformed rows",      1000,   0.0, 0.0, 0.4},
+};
+
+static std::string generate(const Profile& p, long long rows) {
+    TripGenConfig cfg;
+    cfg.rows = rows;
+    cfg.seed = 42;
+    cfg.zones = p.zones;
+    cfg.zipf = p.zipf;
+    cfg.hotShare = p.hotShare;
+    cfg.dirtyShare = p.dirtyShare;
+    cfg.threads = (int)std::thread::hardware_concurrency();
+
+    std::string path = std::string("bench_") + p.name + ".csv";
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f || !writeTrips(cfg, f)) { perror(path.c_str()); exit(1); }
+    fclose(f);
+    return path;
+}
+
+static long long nsSince(Clock::time_point t0) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
+}
+
+int main(int argc, char** argv) {
+    long long rows = 2000000;
+    int threads = 1, reps = 3;
+    const char* only = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        auto val = [&](const char* flag) {
+            if (i + 1 >= argc) { fprintf(stderr, "%s needs a value\n", flag); exit(2); }
+            return argv[++i];
+        };
+        if (!strcmp(argv[i], "--rows")) rows = atoll(val("--rows"));
+        else if (!strcmp(argv[i], "--threads")) threads = atoi(val("--threads"));
+        else if (!strcmp(argv[i], "--reps")) reps = std::max(1, atoi(val("--reps")));
+        else if (!strcmp(argv[i], "--profile")) only = val("--profile");
+        else {
+            fprintf(stderr, "usage: %s [--rows N] [--threads T] [--reps R] [--profile NAME]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    IngestOptions opts;
+    opts.threads = threads;
+
+    printf("# csv scanner %s, %d ingest thread(s), best of %d\n", csvScannerName(), threads, reps);
+    printf("%-8s %10s %9s %12s %9s %14s %12s %12s  %s\n",
+           "profile", "rows", "MB", "rows/s", "MB/s", "ingest_ns", "zones_ns", "slots_ns", "description");
+
+    for (const Profile& p : kProfiles) {
+        if (only && strcmp(only, p.name) != 0) continue;
+
+        std::string path = generate(p, rows);
+        FileStamp st;
+        statFile(path, st);
+        double mb = st.size / 1e6;
+
+        long long bestIngest = -1, bestZones = -1, bestSlots = -1;
+        for (int r = 0; r < reps; r++) {
+            TripAnalyzer ta;
+            ta.setOptions(opts);
+
+            auto t0 = Clock::now();
+            ta.ingestFile(path);
+            long long ingest = nsSince(t0);
+
+            t0 = Clock::now();
+            volatile size_t sink = ta.topZones(10).size();
+            long long zones = nsSince(t0);
+
+            t0 = Clock::now();
+            sink = sink + ta.topBusySlots(10).size();
+            long long slots = nsSince(t0);
+
+            if (bestIngest < 0 || ingest < bestIngest) bestIngest = ingest;
+            if (bestZones < 0 || zones < bestZones) bestZones = zones;
+            if (bestSlots < 0 || slots < bestSlots) bestSlots = slots;
+        }
+
+        double secs = bestIngest / 1e9;
+        printf("%-8s %10lld %9.1f %12.0f %9.1f %14lld %12lld %12lld  %s\n",
+               p.name, rows, mb, rows / secs, mb / secs, bestIngest, bestZones, bestSlots, p.about);
+        fflush(stdout);
+        remove(path.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+using namespace std;
+
+// Fixed-capacity FIFO between pipeline stages. push() blocks while the
+// queue is full, which is what throttles a fast producer; pop() blocks
+// while it is empty and returns false once the queue is closed and
+// drained. Items are whole blocks of input, so a handful of lock
+// operations per megabyte is all the synchronization there is.
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : cap(capacity) {}
+
+    void push(T x) {
+        unique_lock<mutex> lock(m);
+        notFull.wait(lock, [this] { return items.size() < cap; });
+        items.push_back(std::move(x));
+        notEmpty.notify_one();
+    }
+
+    bool pop(T& out) {
+        unique_lock<mutex> lock(m);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        out = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // No more pushes; consumers drain what is left, then pop() fails.
+    void close() {
+        lock_guard<mutex> lock(m);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t cap;
+    bool closed = false;
+    deque<T> items;
+    mutex m;
+    condition_variable notEmpty, notFull;
+};
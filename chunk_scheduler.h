@@ -0,0 +1,83 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+using namespace std;
+
+// Hands out chunk indexes [0, chunks) to a fixed set of workers. Worker w
+// starts out owning the w-th contiguous share and takes its chunks from the
+// front, in file order. A worker that runs dry steals the back half of the
+// largest remaining share, so an expensive region (long rows, dirty data,
+// a hot zone) ends up spread over whoever is free instead of holding up
+// one thread. Each share is a [lo, hi) pair packed in one atomic word, so
+// taking and stealing are single compare-exchanges.
+//
+// With stealing off every worker gets exactly its own share, which keeps
+// the split independent of timing.
+class ChunkScheduler {
+public:
+    ChunkScheduler(uint32_t chunks, int workers, bool steal = true)
+        : n(workers), stealing(steal), shares(new Share[workers]) {
+        for (int w = 0; w < n; w++)
+            shares[w].r.store(pack((uint64_t)chunks * w / n, (uint64_t)chunks * (w + 1) / n),
+                              memory_order_relaxed);
+    }
+
+    // The next chunk for worker w; false once no work is left to take.
+    bool next(int w, uint32_t& chunk) {
+        for (;;) {
+            atomic<uint64_t>& r = shares[w].r;
+            uint64_t cur = r.load(memory_order_acquire);
+            while (lo(cur) < hi(cur)) {
+                if (r.compare_exchange_weak(cur, pack(lo(cur) + 1, hi(cur)), memory_order_acq_rel)) {
+                    chunk = lo(cur);
+                    return true;
+                }
+            }
+            if (!stealing || !stealInto(w)) return false;
+        }
+    }
+
+private:
+    struct alignas(64) Share {
+        atomic<uint64_t> r{0};      // lo << 32 | hi
+    };
+
+    int n;
+    bool stealing;
+    unique_ptr<Share[]> shares;
+
+    static uint64_t pack(uint64_t l, uint64_t h) { return l << 32 | h; }
+    static uint32_t lo(uint64_t r) { return (uint32_t)(r >> 32); }
+    static uint32_t hi(uint64_t r) { return (uint32_t)r; }
+
+    // Moves half of the fullest other share into w's (empty) one. False when
+    // every share is empty; chunks a thief is still carrying over are done
+    // by that thief.
+    bool stealInto(int w) {
+        for (;;) {
+            int victim = -1;
+            uint64_t cur = 0;
+            uint32_t most = 0;
+            for (int v = 0; v < n; v++) {
+                if (v == w) continue;
+                uint64_t x = shares[v].r.load(memory_order_acquire);
+                if (lo(x) < hi(x) && hi(x) - lo(x) > most) {
+                    most = hi(x) - lo(x);
+                    victim = v;
+                    cur = x;
+                }
+            }
+            if (victim < 0) return false;
+
+            uint32_t take = (most + 1) / 2;
+            uint32_t split = hi(cur) - take;
+            if (shares[victim].r.compare_exchange_strong(cur, pack(lo(cur), split),
+                                                         memory_order_acq_rel)) {
+                shares[w].r.store(pack(split, hi(cur)), memory_order_release);
+                return true;
+            }
+        }
+    }
+};
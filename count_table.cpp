@@ -0,0 +1,77 @@
+#include "count_table.h"
+#include <utility>
+
+static inline size_t slotOf(uint64_t key, size_t mask) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (size_t)key & mask;
+}
+
+// An existing key is updated in place; only a new key can grow the table,
+// so adding to a key never rehashes the cells.
+void CountTable::add(uint64_t key, uint64_t n) {
+    if (!cells.empty()) {
+        size_t mask = cells.size() - 1;
+        for (size_t i = slotOf(key, mask);; i = (i + 1) & mask) {
+            Cell& c = cells[i];
+            if (c.key == key) {
+                c.count += n;
+                return;
+            }
+            if (c.key == kEmpty) {
+                if ((used + 1) * 10 > cells.size() * 7) break;
+                c.key = key;
+                c.count = n;
+                used++;
+                return;
+            }
+        }
+    }
+
+    grow();
+    size_t mask = cells.size() - 1;
+    size_t i = slotOf(key, mask);
+    while (cells[i].key != kEmpty) i = (i + 1) & mask;
+    cells[i] = Cell{key, n};
+    used++;
+}
+
+uint64_t CountTable::get(uint64_t key) const {
+    if (cells.empty()) return 0;
+
+    size_t mask = cells.size() - 1;
+    for (size_t i = slotOf(key, mask);; i = (i + 1) & mask) {
+        const Cell& c = cells[i];
+        if (c.key == key) return c.count;
+        if (c.key == kEmpty) return 0;
+    }
+}
+
+void CountTable::grow() {
+    vector<Cell> old;
+    old.swap(cells);
+    cells.assign(old.empty() ? 64 : old.size() * 2, Cell{kEmpty, 0});
+
+    size_t mask = cells.size() - 1;
+    for (const Cell& c : old) {
+        if (c.key == kEmpty) continue;
+        size_t i = slotOf(c.key, mask);
+        while (cells[i].key != kEmpty) i = (i + 1) & mask;
+        cells[i] = c;
+    }
+}
+
+void CountTable::reserve(size_t n) {
+    while (n * 10 > cells.size() * 7) grow();
+}
+
+void CountTable::clear() {
+    cells.clear();
+    used = 0;
+}
+
+void CountTable::swap(CountTable& other) {
+    cells.swap(other.cells);
+    std::swap(used, other.used);
+}
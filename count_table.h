@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Open-addressing map from 64-bit keys to counts, for sparse aggregates
+// whose key space is far larger than the set of keys actually seen
+// (zone x day x hour cells, origin-destination pairs). 16 bytes per
+// slot, linear probing, load factor at most 0.7. UINT64_MAX is reserved.
+class CountTable {
+public:
+    struct Cell {
+        uint64_t key;
+        uint64_t count;
+    };
+
+    void add(uint64_t key, uint64_t n = 1);
+    uint64_t get(uint64_t key) const;   // 0 if absent
+
+    size_t size() const { return used; }
+    bool empty() const { return used == 0; }
+    size_t memoryBytes() const { return cells.size() * sizeof(Cell); }
+
+    void reserve(size_t n);
+    void clear();
+    void swap(CountTable& other);
+
+    // Calls f(key, count) for every entry, in no particular order.
+    template <class F>
+    void forEach(F&& f) const {
+        for (const Cell& c : cells)
+            if (c.key != kEmpty) f(c.key, c.count);
+    }
+
+private:
+    static const uint64_t kEmpty = UINT64_MAX;
+
+    vector<Cell> cells;     // size is zero or a power of two
+    size_t used = 0;
+
+    void grow();
+};
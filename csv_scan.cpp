@@ -0,0 +1,66 @@
+#include "csv_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CSV_SCAN_X86 1
+#endif
+
+static uint64_t scanScalar(const char* block, uint64_t& nlOut) {
+    uint64_t comma = 0, nl = 0;
+    for (int i = 0; i < 64; i++) {
+        comma |= (uint64_t)(block[i] == ',') << i;
+        nl |= (uint64_t)(block[i] == '\n') << i;
+    }
+    nlOut = nl;
+    return comma;
+}
+
+#ifdef CSV_SCAN_X86
+static uint64_t scanSse2(const char* block, uint64_t& nlOut) {
+    const __m128i commas = _mm_set1_epi8(',');
+    const __m128i newlines = _mm_set1_epi8('\n');
+    uint64_t comma = 0, nl = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(block + 16 * i));
+        comma |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, commas)) << (16 * i);
+        nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newlines)) << (16 * i);
+    }
+    nlOut = nl;
+    return comma;
+}
+
+__attribute__((target("avx2")))
+static uint64_t scanAvx2(const char* block, uint64_t& nlOut) {
+    const __m256i commas = _mm256_set1_epi8(',');
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    __m256i lo = _mm256_loadu_si256((const __m256i*)block);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(block + 32));
+    uint64_t comma = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, commas)) |
+                     (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, commas)) << 32;
+    nlOut = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newlines)) |
+            (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newlines)) << 32;
+    return comma;
+}
+#endif
+
+struct ScannerChoice {
+    CsvBlockScanFn fn;
+    const char* name;
+};
+
+static ScannerChoice pickScanner() {
+#ifdef CSV_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {scanAvx2, "avx2"};
+    if (__builtin_cpu_supports("sse2")) return {scanSse2, "sse2"};
+#endif
+    return {scanScalar, "scalar"};
+}
+
+static const ScannerChoice& scanner() {
+    static const ScannerChoice choice = pickScanner();
+    return choice;
+}
+
+CsvBlockScanFn csvBlockScanner() { return scanner().fn; }
+const char* csvScannerName() { return scanner().name; }
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+// Delimiter positions of one CSV row, as found by forEachRow.
+// Only the first five commas are kept: everything after the fifth comma
+// belongs to the last field.
+struct CsvRow {
+    const char* begin;      // first byte of the row
+    const char* end;        // the terminating '\n' (or end of buffer)
+    const char* comma[5];
+    int commas;             // number of valid entries in comma[]
+};
+
+// Bit i of the result is set when block[i] == ','; bit i of nlOut when
+// block[i] == '\n'. The block must have 64 readable bytes.
+typedef uint64_t (*CsvBlockScanFn)(const char* block, uint64_t& nlOut);
+
+// Picks the widest implementation the CPU supports (AVX2, SSE2, scalar).
+// Resolved once, on first use.
+CsvBlockScanFn csvBlockScanner();
+const char* csvScannerName();
+
+// Calls onRow(const CsvRow&) for every row in [b, e), splitting on '\n'
+// exactly like getline: a final unterminated row is reported, an empty
+// tail after the last '\n' is not. Delimiters are found 64 bytes at a time.
+template <class OnRow>
+void forEachRow(const char* b, const char* e, OnRow&& onRow) {
+    CsvBlockScanFn scan = csvBlockScanner();
+
+    CsvRow row;
+    row.begin = b;
+    row.commas = 0;
+
+    auto handle = [&](const char* q, bool isNewline) {
+        if (isNewline) {
+            row.end = q;
+            onRow(row);
+            row.begin = q + 1;
+            row.commas = 0;
+        } else if (row.commas < 5) {
+            row.comma[row.commas++] = q;
+        }
+    };
+
+    const char* p = b;
+    for (; e - p >= 64; p += 64) {
+        uint64_t nl;
+        uint64_t comma = scan(p, nl);
+        uint64_t any = comma | nl;
+        while (any) {
+            int i = __builtin_ctzll(any);
+            any &= any - 1;
+            handle(p + i, (nl >> i) & 1);
+        }
+    }
+
+    for (; p < e; p++) {
+        if (*p == '\n') handle(p, true);
+        else if (*p == ',') handle(p, false);
+    }
+
+    if (row.begin < e) {
+        row.end = e;
+        onRow(row);
+    }
+}
@@ -0,0 +1,93 @@
+#include "hour_counts.h"
+
+// Sparse zones keep their counts in hour order, so an hour's slot is the
+// number of lower hours present.
+static inline int rankOf(uint32_t mask, int hour) {
+    return __builtin_popcount(mask & ((1u << hour) - 1));
+}
+
+long long HourCounts::count(uint32_t id, int hour) const {
+    const Zone& z = zones[id];
+    if (!(z.mask & (1u << hour))) return 0;
+    switch (z.mask & kFormBits) {
+    case kSparse: return z.data[rankOf(z.mask & kHours, hour)];
+    case kDense32: return narrow[z.data[0]].c[hour];
+    default: return (long long)wide[z.data[0]].c[hour];
+    }
+}
+
+void HourCounts::toNarrow(Zone& z) {
+    Block32 b = {};
+    uint32_t m = z.mask & kHours;
+    for (int r = 0; m; r++, m &= m - 1) b.c[__builtin_ctz(m)] = z.data[r];
+
+    z.data[0] = (uint32_t)narrow.size();
+    narrow.push_back(b);
+    z.mask = (z.mask & kHours) | kDense32;
+}
+
+void HourCounts::toWide(Zone& z) {
+    if ((z.mask & kFormBits) == kSparse) toNarrow(z);
+
+    Block64 b;
+    const Block32& n = narrow[z.data[0]];
+    for (int h = 0; h < 24; h++) b.c[h] = n.c[h];
+
+    z.data[0] = (uint32_t)wide.size();
+    wide.push_back(b);
+    z.mask = (z.mask & kHours) | kDense64;
+}
+
+void HourCounts::add(uint32_t id, int hour, uint64_t n) {
+    Zone& z = zones[id];
+    z.total += n;
+    uint32_t bit = 1u << hour;
+    uint32_t form = z.mask & kFormBits;
+
+    if (form == kSparse) {
+        uint32_t hours = z.mask & kHours;
+        int r = rankOf(hours, hour);
+        if (hours & bit) {
+            uint64_t v = (uint64_t)z.data[r] + n;
+            if (v <= UINT32_MAX) {
+                z.data[r] = (uint32_t)v;
+                return;
+            }
+        } else if (__builtin_popcount(hours) < kInline && n <= UINT32_MAX) {
+            for (int i = kInline - 1; i > r; i--) z.data[i] = z.data[i - 1];
+            z.data[r] = (uint32_t)n;
+            z.mask |= bit;
+            return;
+        }
+        toNarrow(z);
+        form = kDense32;
+    }
+
+    z.mask |= bit;
+    if (form == kDense32) {
+        uint32_t& c = narrow[z.data[0]].c[hour];
+        if ((uint64_t)c + n <= UINT32_MAX) {
+            c += (uint32_t)n;
+            return;
+        }
+        toWide(z);
+    }
+    wide[z.data[0]].c[hour] += n;
+}
+
+size_t HourCounts::memoryBytes() const {
+    return zones.capacity() * sizeof(Zone) + narrow.capacity() * sizeof(Block32) +
+           wide.capacity() * sizeof(Block64);
+}
+
+void HourCounts::clear() {
+    zones.clear();
+    narrow.clear();
+    wide.clear();
+}
+
+void HourCounts::swap(HourCounts& other) {
+    zones.swap(other.zones);
+    narrow.swap(other.narrow);
+    wide.swap(other.wide);
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Per-zone trip totals and hour-of-day counts, indexed by dense zone id.
+//
+// Each zone is a 24-byte record: its total, a mask of the hours it has
+// trips in, and either the counts of up to three hours inline (in hour
+// order) or the index of a 24-counter block in a shared pool. Blocks start
+// with 32-bit counters and are copied to a 64-bit block the first time a
+// counter would overflow. A one-trip zone therefore costs 24 bytes instead
+// of 200, and a zone with trips in every hour 120.
+class HourCounts {
+public:
+    size_t size() const { return zones.size(); }
+    bool empty() const { return zones.empty(); }
+    void resize(size_t n) { zones.resize(n); }      // new zones have no trips
+
+    void add(uint32_t id, int hour, uint64_t n = 1);
+
+    long long total(uint32_t id) const { return (long long)zones[id].total; }
+    long long count(uint32_t id, int hour) const;
+    uint32_t hourMask(uint32_t id) const { return zones[id].mask & kHours; }
+
+    // Calls f(hour, count) for every hour of zone id with trips, ascending.
+    template <class F>
+    void forEachHour(uint32_t id, F&& f) const {
+        const Zone& z = zones[id];
+        uint32_t m = z.mask & kHours;
+        int r = 0;
+        while (m) {
+            int h = __builtin_ctz(m);
+            m &= m - 1;
+            switch (z.mask & kFormBits) {
+            case kSparse: f(h, (long long)z.data[r++]); break;
+            case kDense32: f(h, (long long)narrow[z.data[0]].c[h]); break;
+            default: f(h, (long long)wide[z.data[0]].c[h]); break;
+            }
+        }
+    }
+
+    size_t memoryBytes() const;
+    void reserve(size_t n) { zones.reserve(n); }
+    void clear();
+    void swap(HourCounts& other);
+
+private:
+    static const uint32_t kHours = (1u << 24) - 1;
+    static const uint32_t kFormBits = 3u << 30;
+    static const uint32_t kSparse = 0;
+    static const uint32_t kDense32 = 1u << 30;
+    static const uint32_t kDense64 = 2u << 30;
+    static const int kInline = 3;
+
+    struct Zone {
+        uint64_t total = 0;
+        uint32_t mask = 0;          // hours with trips | form
+        uint32_t data[kInline] = {0, 0, 0};  // sparse counts, or data[0] = block
+    };
+    static_assert(sizeof(Zone) == 24, "zone record must stay 24 bytes");
+
+    struct Block32 { uint32_t c[24]; };
+    struct Block64 { uint64_t c[24]; };
+
+    vector<Zone> zones;
+    vector<Block32> narrow;
+    vector<Block64> wide;   // a promoted zone's old narrow block is not reused
+
+    void toNarrow(Zone& z);
+    void toWide(Zone& z);
+};
@@ -0,0 +1,46 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return;
+    }
+
+    len = (size_t)st.st_size;
+    if (len == 0) {
+        close(fd);
+        opened = true;
+        return;
+    }
+
+    void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        len = 0;
+        return;
+    }
+
+    madvise(p, len, MADV_SEQUENTIAL);
+    ptr = (const char*)p;
+    opened = true;
+}
+
+MappedFile::~MappedFile() {
+    if (ptr) munmap((void*)ptr, len);
+}
+
+bool statFile(const string& path, FileStamp& out) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    out.size = (uint64_t)st.st_size;
+    out.mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return true;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Size and modification time of a file, used to tell whether it changed.
+struct FileStamp {
+    uint64_t size = 0;
+    int64_t mtimeNs = 0;
+
+    bool operator==(const FileStamp& o) const { return size == o.size && mtimeNs == o.mtimeNs; }
+};
+
+bool statFile(const string& path, FileStamp& out);
+
+// Read-only mapping of a whole file into memory.
+// ok() is false when the file cannot be opened or mapped (missing file,
+// pipe, ...); an empty regular file is ok() with size() == 0.
+class MappedFile {
+public:
+    explicit MappedFile(const string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool ok() const { return opened; }
+    const char* data() const { return ptr; }
+    size_t size() const { return len; }
+
+private:
+    const char* ptr = nullptr;
+    size_t len = 0;
+    bool opened = false;
+};
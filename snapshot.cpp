@@ -0,0 +1,323 @@
+#include "analyzer.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+// Snapshot layout, native byte order (checked on load), every section
+// 8-byte aligned so a mapped snapshot can be read in place:
+//
+//   [0, 104)   SnapshotHeader
+//   hourMask   uint32[zoneCount], padded to 8 bytes
+//                                      bit h set = zone has trips at hour h
+//   counts     uint64[slotCount]       the nonzero hour counts, zone by zone
+//                                      in id order, hours ascending
+//   nameEnd    uint64[zoneCount]       end offset of each zone name
+//   cells      {uint64 key, uint64 count}[cellCount]
+//                                      zone x day x hour cells (cellKey),
+//                                      present when dates were tracked
+//   routes     {uint64 key, uint64 count}[routeCount]
+//                                      pickup -> dropoff pairs (routeKey),
+//                                      present when routes were tracked
+//   metrics    {uint64 n, sum, min, max}[slotCount][2]
+//                                      fare then distance summary of each
+//                                      stored slot, in counts order; present
+//                                      when the metrics flag is set
+//   dropEnd    uint64[dropoffCount]    end offset of each dropoff zone name
+//   names      char[nameBytes]         zone names, back to back
+//   dropNames  char[dropoffNameBytes]  dropoff zone names, back to back
+//
+// Only nonzero hours are stored, so a one-trip zone costs 20 bytes plus its
+// name. payloadHash covers everything after the header. Totals are not
+// stored; they are the sum of the hour counts.
+
+namespace {
+
+const char kMagic[8] = {'T', 'R', 'I', 'P', 'S', 'N', 'A', 'P'};
+const uint32_t kVersion = 4;
+const uint32_t kByteOrder = 0x01020304;
+const uint32_t kFlagSourceKnown = 1;
+const uint32_t kFlagMetrics = 2;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t sourceSize;
+    int64_t sourceMtimeNs;
+    uint64_t zoneCount;
+    uint64_t slotCount;
+    uint64_t cellCount;
+    uint64_t nameBytes;
+    uint64_t routeCount;
+    uint64_t dropoffCount;
+    uint64_t dropoffNameBytes;
+    uint64_t payloadHash;
+};
+static_assert(sizeof(SnapshotHeader) == 104, "snapshot header must stay 104 bytes");
+
+const uint64_t kMetricBytes = 8 * sizeof(uint64_t);   // per stored slot
+
+uint64_t maskBytes(uint64_t zoneCount) { return (zoneCount * sizeof(uint32_t) + 7) & ~(uint64_t)7; }
+
+template <class T>
+void append(vector<char>& buf, const T& v) {
+    const char* p = (const char*)&v;
+    buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+template <class T>
+T readAt(const char* p) {
+    T v;
+    memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+}  // namespace
+
+bool TripAnalyzer::saveSnapshot(const string& path) const {
+    if (approximate()) return false;
+
+    size_t z = stats.zones.size();
+
+    uint64_t slots = 0, nameBytes = 0;
+    for (size_t i = 0; i < z; i++) {
+        slots += __builtin_popcount(stats.zones.hourMask(i));
+        nameBytes += stats.dict.name(i).size();
+    }
+
+    uint64_t cells = stats.dayCells.size();
+    uint64_t routes = stats.routes.size();
+    size_t d = stats.dropoffs.size();
+    uint64_t dropBytes = 0;
+    for (size_t i = 0; i < d; i++) dropBytes += stats.dropoffs.name(i).size();
+
+    bool hasMetrics = !stats.metrics.empty();
+
+    vector<char> payload;
+    payload.reserve(maskBytes(z) + (slots + z + 2 * cells + 2 * routes + d) * sizeof(uint64_t) +
+                    (hasMetrics ? slots * kMetricBytes : 0) + nameBytes + dropBytes);
+
+    for (size_t i = 0; i < z; i++) append(payload, stats.zones.hourMask(i));
+    payload.resize(maskBytes(z), 0);
+
+    for (size_t i = 0; i < z; i++)
+        stats.zones.forEachHour(i, [&payload](int, long long c) { append(payload, (uint64_t)c); });
+
+    uint64_t end = 0;
+    for (size_t i = 0; i < z; i++) {
+        end += stats.dict.name(i).size();
+        append(payload, end);
+    }
+    auto appendCell = [&payload](uint64_t key, uint64_t count) {
+        append(payload, key);
+        append(payload, count);
+    };
+    stats.dayCells.forEach(appendCell);
+    stats.routes.forEach(appendCell);
+    if (hasMetrics) {
+        const SlotMetrics none;
+        for (size_t i = 0; i < z; i++) {
+            stats.zones.forEachHour(i, [&](int h, long long) {
+                const SlotMetrics* sm = stats.findMetrics(i, h);
+                if (!sm) sm = &none;
+                for (const MetricSummary* m : {&sm->fare, &sm->distance}) {
+                    append(payload, (uint64_t)m->n);
+                    append(payload, (uint64_t)m->sum);
+                    append(payload, (uint64_t)m->min);
+                    append(payload, (uint64_t)m->max);
+                }
+            });
+        }
+    }
+    end = 0;
+    for (size_t i = 0; i < d; i++) {
+        end += stats.dropoffs.name(i).size();
+        append(payload, end);
+    }
+    for (size_t i = 0; i < z; i++) {
+        const string& n = stats.dict.name(i);
+        payload.insert(payload.end(), n.begin(), n.end());
+    }
+    for (size_t i = 0; i < d; i++) {
+        const string& n = stats.dropoffs.name(i);
+        payload.insert(payload.end(), n.begin(), n.end());
+    }
+
+    SnapshotHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, kMagic, sizeof(kMagic));
+    hdr.version = kVersion;
+    hdr.byteOrder = kByteOrder;
+    hdr.flags = (sourceKnown ? kFlagSourceKnown : 0) | (hasMetrics ? kFlagMetrics : 0);
+    hdr.sourceSize = source.size;
+    hdr.sourceMtimeNs = source.mtimeNs;
+    hdr.zoneCount = z;
+    hdr.slotCount = slots;
+    hdr.cellCount = cells;
+    hdr.nameBytes = nameBytes;
+    hdr.routeCount = routes;
+    hdr.dropoffCount = d;
+    hdr.dropoffNameBytes = dropBytes;
+    hdr.payloadHash = ZoneDictionary::hash(string_view(payload.data(), payload.size()));
+
+    // Write beside the target and rename, so readers never see half a file.
+    string tmp = path + ".tmp";
+    {
+        ofstream out(tmp, ios::binary | ios::trunc);
+        if (!out.is_open()) return false;
+        out.write((const char*)&hdr, sizeof(hdr));
+        out.write(payload.data(), payload.size());
+        if (!out.good()) {
+            out.close();
+            remove(tmp.c_str());
+            return false;
+        }
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool TripAnalyzer::readSnapshot(const string& path, ZoneTable& into,
+                                FileStamp& src, bool& srcKnown) {
+    MappedFile mf(path);
+    if (!mf.ok() || mf.size() < sizeof(SnapshotHeader)) return false;
+
+    SnapshotHeader hdr = readAt<SnapshotHeader>(mf.data());
+    if (memcmp(hdr.magic, kMagic, sizeof(kMagic)) != 0) return false;
+    if (hdr.version != kVersion || hdr.byteOrder != kByteOrder) return false;
+
+    // Every zone takes at least 12 bytes, every slot and dropoff zone 8 and
+    // every cell and route 16, which bounds the counts before any
+    // multiplication can overflow.
+    uint64_t payloadSize = mf.size() - sizeof(SnapshotHeader);
+    uint64_t z = hdr.zoneCount;
+    uint64_t d = hdr.dropoffCount;
+    if (z > payloadSize / 12 || hdr.slotCount > payloadSize / 8 || d > payloadSize / 8 ||
+        hdr.cellCount > payloadSize / 16 || hdr.routeCount > payloadSize / 16 ||
+        hdr.nameBytes > payloadSize || hdr.dropoffNameBytes > payloadSize) return false;
+    bool hasMetrics = (hdr.flags & kFlagMetrics) != 0;
+    uint64_t metricBytes = hasMetrics ? hdr.slotCount * kMetricBytes : 0;
+    if (payloadSize != maskBytes(z) +
+                       (hdr.slotCount + z + 2 * hdr.cellCount + 2 * hdr.routeCount + d) *
+                           sizeof(uint64_t) +
+                       metricBytes + hdr.nameBytes + hdr.dropoffNameBytes)
+        return false;
+
+    const char* payload = mf.data() + sizeof(SnapshotHeader);
+    if (ZoneDictionary::hash(string_view(payload, payloadSize)) != hdr.payloadHash) return false;
+
+    const char* masks = payload;
+    const char* counts = masks + maskBytes(z);
+    const char* nameEnd = counts + hdr.slotCount * sizeof(uint64_t);
+    const char* cells = nameEnd + z * sizeof(uint64_t);
+    const char* routes = cells + hdr.cellCount * 2 * sizeof(uint64_t);
+    const char* metrics = routes + hdr.routeCount * 2 * sizeof(uint64_t);
+    const char* dropEnd = metrics + metricBytes;
+    const char* names = dropEnd + d * sizeof(uint64_t);
+    const char* dropNames = names + hdr.nameBytes;
+
+    ZoneTable t;
+    t.dict.reserve(z);
+    t.zones.resize(z);
+
+    uint64_t prev = 0, slot = 0;
+    for (uint64_t i = 0; i < z; i++) {
+        uint64_t end = readAt<uint64_t>(nameEnd + i * sizeof(uint64_t));
+        if (end < prev || end > hdr.nameBytes) return false;
+        if (t.dict.intern(string_view(names + prev, end - prev)) != i) return false;  // duplicate
+        prev = end;
+
+        uint32_t mask = readAt<uint32_t>(masks + i * sizeof(uint32_t));
+        if (mask >> 24) return false;
+
+        for (int h = 0; h < 24; h++) {
+            if (!(mask & (1u << h))) continue;
+            if (slot == hdr.slotCount) return false;
+            if (hasMetrics) {
+                // Slots stored without a fare or distance stay absent.
+                const char* m = metrics + slot * kMetricBytes;
+                SlotMetrics sm;
+                for (MetricSummary* ms : {&sm.fare, &sm.distance}) {
+                    ms->n = (long long)readAt<uint64_t>(m);
+                    ms->sum = (long long)readAt<uint64_t>(m + 8);
+                    ms->min = (long long)readAt<uint64_t>(m + 16);
+                    ms->max = (long long)readAt<uint64_t>(m + 24);
+                    m += 4 * sizeof(uint64_t);
+                }
+                if (sm.fare.n || sm.distance.n) t.metricsAt((uint32_t)i, h) = sm;
+            }
+            uint64_t c = readAt<uint64_t>(counts + slot++ * sizeof(uint64_t));
+            if (c == 0) return false;
+            t.zones.add(i, h, c);
+        }
+    }
+    if (prev != hdr.nameBytes || slot != hdr.slotCount) return false;
+
+    t.dayCells.reserve(hdr.cellCount);
+    for (uint64_t i = 0; i < hdr.cellCount; i++) {
+        uint64_t key = readAt<uint64_t>(cells + i * 2 * sizeof(uint64_t));
+        uint64_t count = readAt<uint64_t>(cells + (i * 2 + 1) * sizeof(uint64_t));
+        if (cellZone(key) >= z || cellHour(key) > 23 || key == UINT64_MAX) return false;
+        t.dayCells.add(key, count);
+    }
+
+    prev = 0;
+    t.dropoffs.reserve(d);
+    for (uint64_t i = 0; i < d; i++) {
+        uint64_t end = readAt<uint64_t>(dropEnd + i * sizeof(uint64_t));
+        if (end < prev || end > hdr.dropoffNameBytes) return false;
+        if (t.dropoffs.intern(string_view(dropNames + prev, end - prev)) != i) return false;
+        prev = end;
+    }
+    if (prev != hdr.dropoffNameBytes) return false;
+
+    t.routes.reserve(hdr.routeCount);
+    for (uint64_t i = 0; i < hdr.routeCount; i++) {
+        uint64_t key = readAt<uint64_t>(routes + i * 2 * sizeof(uint64_t));
+        uint64_t count = readAt<uint64_t>(routes + (i * 2 + 1) * sizeof(uint64_t));
+        if (routeFrom(key) >= z || routeTo(key) >= d) return false;
+        t.routes.add(key, count);
+    }
+
+    into.swap(t);
+    src.size = hdr.sourceSize;
+    src.mtimeNs = hdr.sourceMtimeNs;
+    srcKnown = (hdr.flags & kFlagSourceKnown) != 0;
+    return true;
+}
+
+bool TripAnalyzer::loadSnapshot(const string& path, const string& csvPath) {
+    ZoneTable t;
+    FileStamp src;
+    bool srcKnown;
+    if (!readSnapshot(path, t, src, srcKnown)) return false;
+
+    if (!csvPath.empty()) {
+        FileStamp now;
+        if (!srcKnown || !statFile(csvPath, now) || !(now == src)) return false;
+    }
+
+    stats.swap(t);
+    source = src;
+    sourceKnown = srcKnown;
+    invalidateRankings();
+    tails.clear();
+    return true;
+}
+
+bool TripAnalyzer::mergeSnapshot(const string& path) {
+    ZoneTable t;
+    FileStamp src;
+    bool srcKnown;
+    if (!readSnapshot(path, t, src, srcKnown)) return false;
+
+    stats.mergeFrom(t);
+    sourceKnown = false;
+    invalidateRankings();
+    return true;
+}
@@ -0,0 +1,164 @@
+#include "space_saving.h"
+#include "zone_dict.h"
+#include <algorithm>
+#include <utility>
+
+void SpaceSaving::reset(size_t capacity) {
+    cap = capacity;
+    seen = 0;
+    entries.clear();
+    heap.clear();
+    heapPos.clear();
+    index.clear();
+
+    // Load factor at most 0.5, so probes stay short without Robin Hood.
+    size_t slots = 16;
+    while (slots < capacity * 2) slots *= 2;
+    if (capacity) index.assign(slots, kEmpty);
+    entries.reserve(capacity);
+    heap.reserve(capacity);
+    heapPos.reserve(capacity);
+}
+
+size_t SpaceSaving::slotOf(uint64_t hash, string_view key) const {
+    size_t mask = index.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t e = index[i];
+        if (e == kEmpty) return i;
+        if (entries[e].hash == hash && entries[e].key == key) return i;
+    }
+}
+
+const SpaceSaving::Entry* SpaceSaving::find(string_view key) const {
+    if (index.empty()) return nullptr;
+    uint32_t e = index[slotOf(ZoneDictionary::hash(key), key)];
+    return e == kEmpty ? nullptr : &entries[e];
+}
+
+// Removes entry e from the index, pulling later keys of the probe run back
+// into the hole so no tombstones are needed.
+void SpaceSaving::unindex(uint32_t e) {
+    size_t mask = index.size() - 1;
+    size_t hole = slotOf(entries[e].hash, entries[e].key);
+    for (size_t j = (hole + 1) & mask; index[j] != kEmpty; j = (j + 1) & mask) {
+        size_t home = entries[index[j]].hash & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            index[hole] = index[j];
+            hole = j;
+        }
+    }
+    index[hole] = kEmpty;
+}
+
+void SpaceSaving::add(string_view key, uint64_t n) {
+    if (cap == 0) return;
+    seen += n;
+
+    uint64_t h = ZoneDictionary::hash(key);
+    size_t slot = slotOf(h, key);
+    uint32_t e = index[slot];
+    if (e != kEmpty) {
+        entries[e].count += n;
+        siftDown(heapPos[e]);
+        return;
+    }
+
+    if (entries.size() < cap) {
+        e = (uint32_t)entries.size();
+        entries.push_back({string(key), h, n, 0});
+        heapPos.push_back((uint32_t)heap.size());
+        heap.push_back(e);
+        index[slot] = e;
+        siftUp(heap.size() - 1);
+        return;
+    }
+
+    // Evict the minimum: the newcomer inherits its count as error. The
+    // string is reassigned in place, so steady state does not allocate.
+    e = heap[0];
+    unindex(e);
+    Entry& victim = entries[e];
+    victim.key.assign(key.data(), key.size());
+    victim.hash = h;
+    victim.error = victim.count;
+    victim.count += n;
+    index[slotOf(h, key)] = e;
+    siftDown(0);
+}
+
+void SpaceSaving::mergeFrom(const SpaceSaving& other) {
+    if (other.cap == 0) return;
+    if (cap == 0) {
+        *this = other;
+        return;
+    }
+
+    uint64_t minA = minCount(), minB = other.minCount();
+    vector<Entry> all;
+    all.reserve(entries.size() + other.entries.size());
+    for (const Entry& a : entries) {
+        const Entry* b = other.find(a.key);
+        all.push_back({a.key, a.hash, a.count + (b ? b->count : minB),
+                       a.error + (b ? b->error : minB)});
+    }
+    for (const Entry& b : other.entries)
+        if (!find(b.key)) all.push_back({b.key, b.hash, b.count + minA, b.error + minA});
+
+    // Largest counts first; keys break ties so the result is deterministic.
+    auto before = [](const Entry& x, const Entry& y) {
+        return x.count != y.count ? x.count > y.count : x.key < y.key;
+    };
+    if (all.size() > cap) {
+        nth_element(all.begin(), all.begin() + cap, all.end(), before);
+        all.resize(cap);
+    }
+
+    uint64_t total = seen + other.seen;
+    size_t c = cap;
+    reset(c);
+    seen = total;
+    for (Entry& x : all) {
+        uint32_t e = (uint32_t)entries.size();
+        index[slotOf(x.hash, x.key)] = e;
+        heapPos.push_back(e);
+        heap.push_back(e);
+        entries.push_back(std::move(x));
+    }
+    for (size_t i = heap.size() / 2; i-- > 0;) siftDown(i);
+}
+
+void SpaceSaving::swap(SpaceSaving& other) {
+    std::swap(cap, other.cap);
+    std::swap(seen, other.seen);
+    entries.swap(other.entries);
+    heap.swap(other.heap);
+    heapPos.swap(other.heapPos);
+    index.swap(other.index);
+}
+
+void SpaceSaving::swapHeap(size_t a, size_t b) {
+    std::swap(heap[a], heap[b]);
+    heapPos[heap[a]] = (uint32_t)a;
+    heapPos[heap[b]] = (uint32_t)b;
+}
+
+void SpaceSaving::siftUp(size_t pos) {
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+        if (entries[heap[parent]].count <= entries[heap[pos]].count) return;
+        swapHeap(pos, parent);
+        pos = parent;
+    }
+}
+
+void SpaceSaving::siftDown(size_t pos) {
+    size_t n = heap.size();
+    for (;;) {
+        size_t l = pos * 2 + 1, r = l + 1, m = pos;
+        if (l < n && entries[heap[l]].count < entries[heap[m]].count) m = l;
+        if (r < n && entries[heap[r]].count < entries[heap[m]].count) m = r;
+        if (m == pos) return;
+        swapHeap(pos, m);
+        pos = m;
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Space-Saving heavy-hitters summary (Metwally et al.) holding at most
+// capacity() keys, so memory stays fixed however many distinct keys the
+// stream has. Each kept key has an estimated count and an error with
+//
+//     count - error <= true count <= count,
+//
+// and every key whose true count exceeds total() / capacity() is kept.
+// Keys live in an indexed min-heap on count, found through a linear-probing
+// index with backward-shift deletion, so an add is one probe plus a sift.
+// A capacity of zero means the summary is switched off.
+class SpaceSaving {
+public:
+    struct Entry {
+        string key;
+        uint64_t hash;
+        uint64_t count;
+        uint64_t error;
+    };
+
+    void reset(size_t capacity);    // empties the summary
+    size_t capacity() const { return cap; }
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    bool full() const { return cap != 0 && entries.size() >= cap; }
+    uint64_t total() const { return seen; }
+
+    void add(string_view key, uint64_t n = 1);
+    const Entry* find(string_view key) const;   // nullptr if not kept
+
+    // The kept keys, in no particular order.
+    const vector<Entry>& items() const { return entries; }
+
+    // Folds other into this summary (Agarwal et al.'s mergeable form): a key
+    // missing from a full side is charged that side's minimum count as both
+    // count and error, then the capacity() largest counts are kept. The
+    // bounds above hold for the combined stream.
+    void mergeFrom(const SpaceSaving& other);
+
+    void clear() { reset(0); }
+    void swap(SpaceSaving& other);
+
+private:
+    static constexpr uint32_t kEmpty = UINT32_MAX;
+
+    size_t cap = 0;
+    uint64_t seen = 0;
+    vector<Entry> entries;
+    vector<uint32_t> heap;      // entry indexes, min-heap on count
+    vector<uint32_t> heapPos;   // heapPos[e] = position of entry e in heap
+    vector<uint32_t> index;     // entry indexes by hash; size a power of two
+
+    uint64_t minCount() const { return full() ? entries[heap[0]].count : 0; }
+    size_t slotOf(uint64_t hash, string_view key) const;    // its slot, or the empty one ending the probe
+    void unindex(uint32_t e);
+    void siftUp(size_t pos);
+    void siftDown(size_t pos);
+    void swapHeap(size_t a, size_t b);
+};
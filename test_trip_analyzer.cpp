@@ -1,10 +1,27 @@
 #include "analyzer.h"
+#include "trip_server.h"
+#include "zone_dict.h"
+#include "count_table.h"
+#include "hour_counts.h"
+#include "topk.h"
+#include "trip_gen.h"
 #include "catch_amalgamated.hpp"
 
 #include <fstream>
 #include <string>
 #include <vector>
 #include <cstdio>   // std::remove
+#include <iterator>
+#include <tuple>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 // ------------------- helpers -------------------
 static void writeFile(const std::string& path, const std::vector<std::string>& lines) {
@@ -281,3 +298,1838 @@ TEST_CASE("C3", "[C3]") {
 
     std::remove(path.c_str());
 }
+
+// ------------------- D: ingestion modes and extended queries -------------------
+
+static bool sameResults(const TripAnalyzer& a, const TripAnalyzer& b, int k) {
+    auto za = a.topZones(k), zb = b.topZones(k);
+    auto sa = a.topBusySlots(k), sb = b.topBusySlots(k);
+    if (za.size() != zb.size() || sa.size() != sb.size()) return false;
+    for (size_t i = 0; i < za.size(); ++i)
+        if (za[i].zone != zb[i].zone || za[i].count != zb[i].count) return false;
+    for (size_t i = 0; i < sa.size(); ++i)
+        if (sa[i].zone != sb[i].zone || sa[i].hour != sb[i].hour || sa[i].count != sb[i].count) return false;
+    return true;
+}
+
+TEST_CASE("D1", "[D][D1]") {
+    const std::string path = "d1.csv";
+
+    // CRLF endings, padded fields, junk rows and no trailing newline
+    std::ofstream out(path, std::ios::binary);
+    REQUIRE(out.is_open());
+    out << HDR << "\r\n"
+        << "1, ZONE_A ,ZX,2024-01-01 09:15,1.2,10.0\r\n"
+        << "\r\n"
+        << "2,ZONE_A,ZX,2024-01-01 9:05\r\n"
+        << "3,ZONE_B,ZX,2024-01-01 123:00,1,1\r\n"
+        << "4,ZONE_B,ZX,2024-01-01 07:00,1,1,extra\n"
+        << "5,ZONE_C,ZX,2024-01-01 23:59,1,1";
+    out.close();
+
+    TripAnalyzer mapped, streamed;
+    IngestOptions o;
+    o.useMmap = false;
+    streamed.setOptions(o);
+
+    mapped.ingestFile(path);
+    streamed.ingestFile(path);
+
+    REQUIRE(sameResults(mapped, streamed, 100));
+    auto topZ = mapped.topZones(10);
+    REQUIRE(topZ.size() == 3);
+    REQUIRE(hasZone(topZ, "ZONE_A", 1));
+    REQUIRE(hasZone(topZ, "ZONE_B", 1));
+    REQUIRE(hasZone(topZ, "ZONE_C", 1));
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D2", "[D][D2]") {
+    const std::string path = "d2.csv";
+
+    // Large enough (~4 MB) to be split across workers, with dirty rows mixed in
+    std::ofstream out(path);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    for (int i = 0; i < 80000; ++i) {
+        if (i % 97 == 0) { out << i << ",BROKEN_ROW\n"; continue; }
+        char buf[96];
+        std::snprintf(buf, sizeof(buf), "%d,ZONE_%d,ZX,2024-01-01 %02d:%02d,1.0,5.0\n",
+                      i, (i * 7919) % 3001, (i * 31) % 24, i % 60);
+        out << buf;
+    }
+    out.close();
+
+    TripAnalyzer serial, parallel;
+    IngestOptions o;
+    o.threads = 4;
+    parallel.setOptions(o);
+
+    serial.ingestFile(path);
+    parallel.ingestFile(path);
+
+    REQUIRE(!serial.topZones(1).empty());
+    REQUIRE(sameResults(serial, parallel, 1000000));
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D3", "[D][D3]") {
+    const std::string path = "d3.csv";
+
+    // Rows of every length from tiny to several hundred bytes, so delimiters
+    // land on all positions of the 64-byte scan blocks; some rows are short
+    // by a field or carry extra commas in the last one.
+    std::ofstream out(path, std::ios::binary);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    unsigned seed = 12345;
+    auto next = [&seed]() { seed = seed * 1103515245u + 12345u; return (seed >> 16) & 0x7fff; };
+    for (int i = 0; i < 5000; ++i) {
+        std::string pad(next() % 300, ' ');
+        std::string zone = "Z" + std::to_string(next() % 50) + std::string(next() % 3, 'x');
+        int kind = next() % 10;
+        out << i << "," << pad << zone << pad << ",ZX," << pad;
+        if (kind == 0) out << "2024-01-01 ,1,1\n";
+        else if (kind == 1) out << "2024-01-01 0" << next() % 10 << ":00,1\n";
+        else out << "2024-01-01 " << next() % 24 << ":00,1," << std::string(next() % 5, ',') << "1\n";
+    }
+    out.close();
+
+    TripAnalyzer mapped, streamed;
+    IngestOptions o;
+    o.useMmap = false;
+    streamed.setOptions(o);
+
+    mapped.ingestFile(path);
+    streamed.ingestFile(path);
+
+    REQUIRE(!mapped.topZones(1).empty());
+    REQUIRE(sameResults(mapped, streamed, 100000));
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D4", "[D][D4]") {
+    const std::string p1 = "d4a.csv", p2 = "d4b.csv";
+
+    std::vector<std::string> rows{HDR};
+    for (int i = 0; i < 400; ++i)
+        rows.push_back(std::to_string(i) + ",Z" + std::to_string(i % 37 * (i % 5)) +
+                       ",ZX,2024-01-01 " + std::to_string(i % 24) + ":00,1,1");
+    writeFile(p1, rows);
+    writeFile(p2, {HDR, "1,ONLY,ZX,2024-01-01 05:00,1,1"});
+
+    // Cached rankings answer any k, in any order, like a fresh analyzer
+    TripAnalyzer ta;
+    ta.ingestFile(p1);
+    for (int k : {1, 5, 3, 2, 40, 7, 1000, 4}) {
+        TripAnalyzer fresh;
+        fresh.ingestFile(p1);
+        REQUIRE(sameResults(ta, fresh, k));
+    }
+
+    // Queries from several threads build the caches once, consistently
+    TripAnalyzer shared, ref;
+    shared.ingestFile(p1);
+    ref.ingestFile(p1);
+    auto sameWindow = [&](int k) {
+        auto a = shared.topZones(k, 22, 2), b = ref.topZones(k, 22, 2);
+        if (a.size() != b.size()) return false;
+        for (size_t i = 0; i < a.size(); ++i)
+            if (a[i].zone != b[i].zone || a[i].count != b[i].count) return false;
+        return true;
+    };
+    std::vector<std::thread> readers;
+    std::vector<int> ok(4, 0);
+    for (int t = 0; t < 4; ++t)
+        readers.emplace_back([&, t] {
+            for (int k = 1 + t; k < 200; k += 7) ok[t] += sameResults(shared, ref, k) && sameWindow(k);
+        });
+    for (auto& r : readers) r.join();
+    for (int t = 0; t < 4; ++t) REQUIRE(ok[t] == (199 - t + 6) / 7);
+
+    // Ingesting again drops the cached rankings
+    ta.ingestFile(p2);
+    auto topZ = ta.topZones(10);
+    REQUIRE(topZ.size() == 1);
+    REQUIRE(topZ[0].zone == "ONLY");
+    auto topS = ta.topBusySlots(10);
+    REQUIRE(topS.size() == 1);
+    REQUIRE(hasSlot(topS, "ONLY", 5, 1));
+
+    std::remove(p1.c_str());
+    std::remove(p2.c_str());
+}
+
+TEST_CASE("D5", "[D][D5]") {
+    const std::string csv = "d5.csv", snap = "d5.snap";
+
+    writeFile(csv, {
+        HDR,
+        "1,ZONE_A,ZX,2024-01-01 09:15,1,1",
+        "2,ZONE_B,ZX,2024-01-01 23:59,1,1",
+        "3,ZONE_A,ZX,2024-01-01 09:40,1,1",
+        "4,ZONE_C,ZX,2024-01-01 00:00,1,1"
+    });
+
+    TripAnalyzer ta;
+    ta.ingestFile(csv);
+    REQUIRE(ta.saveSnapshot(snap));
+
+    // Round trip while the source is unchanged
+    TripAnalyzer restored;
+    REQUIRE(restored.loadSnapshot(snap, csv));
+    REQUIRE(sameResults(ta, restored, 100));
+
+    // Source changed since the snapshot: rejected, state untouched
+    {
+        std::ofstream out(csv, std::ios::app);
+        out << "5,ZONE_C,ZX,2024-01-01 01:00,1,1\n";
+    }
+    TripAnalyzer stale;
+    REQUIRE_FALSE(stale.loadSnapshot(snap, csv));
+    REQUIRE(stale.topZones(10).empty());
+    REQUIRE(stale.loadSnapshot(snap, ""));
+    REQUIRE(sameResults(ta, stale, 100));
+
+    // Truncated snapshot: rejected
+    {
+        std::ifstream in(snap, std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream out(snap, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), bytes.size() - 3);
+    }
+    REQUIRE_FALSE(restored.loadSnapshot(snap, ""));
+    REQUIRE(sameResults(ta, restored, 100));
+    REQUIRE_FALSE(restored.loadSnapshot("missing_snapshot_123.snap", ""));
+
+    std::remove(csv.c_str());
+    std::remove(snap.c_str());
+}
+
+TEST_CASE("D6", "[D][D6]") {
+    const std::string whole = "d6.csv", snap = "d6.snap";
+    const std::string shards[3] = {"d6_0.csv", "d6_1.csv", "d6_2.csv"};
+
+    // One file and the same rows dealt round-robin into three shards
+    std::vector<std::string> all{HDR}, part[3];
+    for (int s = 0; s < 3; ++s) part[s].push_back(HDR);
+    for (int i = 0; i < 900; ++i) {
+        std::string row = std::to_string(i) + ",Z" + std::to_string((i * i) % 41) +
+                          ",ZX,2024-01-01 " + std::to_string((i * 7) % 24) + ":00,1,1";
+        all.push_back(row);
+        part[i % 3].push_back(row);
+    }
+    writeFile(whole, all);
+    for (int s = 0; s < 3; ++s) writeFile(shards[s], part[s]);
+
+    TripAnalyzer full, a, b, c;
+    full.ingestFile(whole);
+    a.ingestFile(shards[0]);
+    b.ingestFile(shards[1]);
+    c.ingestFile(shards[2]);
+
+    // (a + b) + c
+    TripAnalyzer left;
+    left.merge(a);
+    left.merge(b);
+    left.merge(c);
+    REQUIRE(sameResults(full, left, 1000));
+
+    // c + (b + a), with b + a coming back from a snapshot
+    TripAnalyzer ba;
+    ba.merge(b);
+    ba.merge(a);
+    REQUIRE(ba.saveSnapshot(snap));
+    TripAnalyzer right;
+    right.merge(c);
+    REQUIRE(right.mergeSnapshot(snap));
+    REQUIRE(sameResults(full, right, 1000));
+
+    REQUIRE_FALSE(right.mergeSnapshot("missing_snapshot_123.snap"));
+    REQUIRE(sameResults(full, right, 1000));
+
+    // Merging an analyzer into itself doubles everything, dates, routes
+    // and metrics included. 89 keys, each added once, fill a 128-slot table
+    // to its growth limit, so a merge that could grow the table it walks
+    // would rehash it under the walk.
+    std::vector<std::string> rows{HDR};
+    for (int i = 0; i < 89; ++i) {
+        int z = i;
+        rows.push_back(std::to_string(i) + ",Z" + std::to_string(z) + ",D" + std::to_string(z) +
+                       ",2024-0" + std::to_string(1 + z % 9) + "-1" + std::to_string(z % 10) + " " +
+                       std::to_string(z % 24) + ":00,1." + std::to_string(i % 10) + ",7.5");
+    }
+    writeFile(whole, rows);
+    IngestOptions o;
+    o.trackDates = o.trackRoutes = o.trackMetrics = true;
+    TripAnalyzer self, other, twice;
+    for (TripAnalyzer* t : {&self, &other, &twice}) {
+        t->setOptions(o);
+        t->ingestFile(whole);
+    }
+    self.merge(self);
+    twice.merge(other);
+    REQUIRE(sameResults(self, twice, 1000));
+    auto r1 = self.topRoutes(100000), r2 = twice.topRoutes(100000);
+    REQUIRE(r1.size() == r2.size());
+    for (size_t i = 0; i < r1.size(); ++i) REQUIRE(r1[i].count == r2[i].count);
+    auto d1 = self.topZonesInDates(1000, "2024-01-01", "2024-12-31");
+    auto d2 = twice.topZonesInDates(1000, "2024-01-01", "2024-12-31");
+    REQUIRE(d1.size() == 89);
+    for (size_t i = 0; i < d1.size(); ++i) REQUIRE(d1[i].count == d2[i].count);
+    REQUIRE(self.zoneMetrics("Z5").fare.sum == twice.zoneMetrics("Z5").fare.sum);
+    REQUIRE(self.zoneCount("Z5") == 2 * other.zoneCount("Z5"));
+
+    std::remove(whole.c_str());
+    std::remove(snap.c_str());
+    for (const auto& s : shards) std::remove(s.c_str());
+}
+
+TEST_CASE("D7", "[D][D7]") {
+    const std::string path = "d7.csv";
+
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZX,2024-01-01 09:15,1.2,10.0",    // accepted
+        "",                                         // blank
+        "2,ZONE_A,ZX,2024-01-01 10:00",             // too few fields
+        "3,,ZX,2024-01-01 09:15,1.2,10.0",          // empty zone
+        "4,ZONE_A,ZX, ,1.2,10.0",                   // empty time
+        "5,ZONE_B,ZY,NOT_A_DATE,2.0,12.5",          // bad time
+        "6,ZONE_B,ZY,2024-01-01 24:00,2.0,12.5",    // hour out of range
+        "7,ZONE_B,ZY,2024-01-01 123:00,2.0,12.5",   // hour out of range
+        "8,ZONE_B,ZY,2024-01-01 23:59,2.0,12.5"     // accepted
+    });
+
+    for (bool mmap : {true, false}) {
+        TripAnalyzer ta;
+        IngestOptions o;
+        o.useMmap = mmap;
+        ta.setOptions(o);
+        ta.ingestFile(path);
+
+        IngestStats st = ta.ingestStats();
+        REQUIRE(st.rows == 9);
+        REQUIRE(st.rowsAccepted == 2);
+        REQUIRE(st.blankLines == 1);
+        REQUIRE(st.tooFewFields == 1);
+        REQUIRE(st.emptyZone == 1);
+        REQUIRE(st.emptyTime == 1);
+        REQUIRE(st.badTime == 1);
+        REQUIRE(st.hourOutOfRange == 2);
+        REQUIRE(st.bytesRead > 0);
+        REQUIRE(st.ingestNs >= st.readNs);
+    }
+
+    TripAnalyzer missing;
+    missing.ingestFile("missing_file_hopefully_123.csv");
+    REQUIRE(missing.ingestStats().rows == 0);
+    REQUIRE(missing.ingestStats().bytesRead == 0);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D8", "[D][D8]") {
+    const std::string path = "d8.csv";
+
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZX,2024-01-01 07:10,1,1",
+        "2,ZONE_A,ZX,2024-01-01 08:10,1,1",
+        "3,ZONE_A,ZX,2024-01-01 12:00,1,1",
+        "4,ZONE_B,ZX,2024-01-01 09:59,1,1",
+        "5,ZONE_B,ZX,2024-01-01 10:00,1,1",
+        "6,ZONE_C,ZX,2024-01-01 23:30,1,1",
+        "7,ZONE_C,ZX,2024-01-01 00:30,1,1",
+        "8,ZONE_C,ZX,2024-01-01 01:30,1,1",
+        "9,ZONE_D,ZX,2024-01-01 11:00,1,1"
+    });
+
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+
+    // 07-10 rush: ZONE_A 2, ZONE_B 2 (tie -> zone asc); C and D have none
+    auto rush = ta.topZones(10, 7, 10);
+    REQUIRE(rush.size() == 2);
+    REQUIRE(rush[0].zone == "ZONE_A");
+    REQUIRE(rush[0].count == 2);
+    REQUIRE(rush[1].zone == "ZONE_B");
+    REQUIRE(rush[1].count == 2);
+
+    // Window wrapping midnight
+    auto night = ta.topZones(10, 23, 1);
+    REQUIRE(night.size() == 1);
+    REQUIRE(hasZone(night, "ZONE_C", 3));
+
+    // Full day equals the plain ranking, small k uses selection
+    auto all = ta.topZones(10, 0, 23);
+    auto plain = ta.topZones(10);
+    REQUIRE(all.size() == plain.size());
+    for (size_t i = 0; i < all.size(); ++i) {
+        REQUIRE(all[i].zone == plain[i].zone);
+        REQUIRE(all[i].count == plain[i].count);
+    }
+    auto one = ta.topZones(1, 9, 12);
+    REQUIRE(one.size() == 1);
+    REQUIRE(one[0].zone == "ZONE_B");
+
+    REQUIRE(ta.topZones(10, -1, 5).empty());
+    REQUIRE(ta.topZones(10, 3, 24).empty());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D9", "[D][D9]") {
+    const std::string path = "d9.csv";
+    const std::string snap = "d9.snap";
+
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZX,2024-02-28 07:10,1,1",
+        "2,ZONE_A,ZX,2024-02-29 07:20,1,1",
+        "3,ZONE_A,ZX,2024-03-01 07:30,1,1",
+        "4,ZONE_B,ZX,2024-02-29 09:00,1,1",
+        "5,ZONE_B,ZX,2024-02-29 09:15,1,1",
+        "6,ZONE_B,ZX,2024-03-02 18:00,1,1",
+        "7,ZONE_C,ZX,10:45,1,1",
+        "8,ZONE_C,ZX,2023-02-29 10:45,1,1"
+    });
+
+    IngestOptions o;
+    o.trackDates = true;
+    TripAnalyzer ta;
+    ta.setOptions(o);
+    ta.ingestFile(path);
+
+    // Rows without a valid date still count in the plain rankings
+    REQUIRE(ta.ingestStats().undated == 2);
+    REQUIRE(hasZone(ta.topZones(10), "ZONE_C", 2));
+
+    auto leap = ta.topZonesInDates(10, "2024-02-29", "2024-02-29");
+    REQUIRE(leap.size() == 2);
+    REQUIRE(leap[0].zone == "ZONE_B");
+    REQUIRE(leap[0].count == 2);
+    REQUIRE(leap[1].zone == "ZONE_A");
+    REQUIRE(leap[1].count == 1);
+
+    auto span = ta.topZonesInDates(10, "2024-02-28", "2024-03-01");
+    REQUIRE(span.size() == 2);
+    REQUIRE(span[0].zone == "ZONE_A");
+    REQUIRE(span[0].count == 3);
+
+    auto slots = ta.topBusySlotsInDates(2, "2024-01-01", "2024-12-31");
+    REQUIRE(slots.size() == 2);
+    REQUIRE(slots[0].zone == "ZONE_A");
+    REQUIRE(slots[0].hour == 7);
+    REQUIRE(slots[0].count == 3);
+    REQUIRE(slots[1].zone == "ZONE_B");
+    REQUIRE(slots[1].hour == 9);
+
+    REQUIRE(ta.topZonesInDates(10, "2024-03-03", "2024-12-31").empty());
+    REQUIRE(ta.topZonesInDates(10, "2024-03-01", "2024-02-28").empty());
+    REQUIRE(ta.topZonesInDates(10, "2024-13-01", "2024-12-31").empty());
+    REQUIRE(ta.topBusySlotsInDates(0, "2024-01-01", "2024-12-31").empty());
+
+    // The cube survives a snapshot round trip
+    REQUIRE(ta.saveSnapshot(snap));
+    TripAnalyzer restored;
+    REQUIRE(restored.loadSnapshot(snap, path));
+    auto again = restored.topZonesInDates(10, "2024-02-29", "2024-02-29");
+    REQUIRE(again.size() == leap.size());
+    for (size_t i = 0; i < again.size(); ++i) {
+        REQUIRE(again[i].zone == leap[i].zone);
+        REQUIRE(again[i].count == leap[i].count);
+    }
+
+    // Without trackDates nothing is kept
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(plain.topZonesInDates(10, "2024-01-01", "2024-12-31").empty());
+    REQUIRE(plain.ingestStats().undated == 0);
+
+    // Parallel ingest and merge build the same cube
+    std::ofstream out(path, std::ios::binary);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    for (int i = 0; i < 60000; ++i) {
+        char buf[96];
+        std::snprintf(buf, sizeof(buf), "%d,ZONE_%d,ZX,2024-%02d-%02d %02d:00,1,1\n",
+                      i, (i * 7919) % 211, 1 + i % 12, 1 + (i * 13) % 28, (i * 31) % 24);
+        out << buf;
+    }
+    out.close();
+
+    TripAnalyzer serial, parallel, merged;
+    o.threads = 4;
+    parallel.setOptions(o);
+    o.threads = 1;
+    serial.setOptions(o);
+    serial.ingestFile(path);
+    parallel.ingestFile(path);
+    merged.merge(serial);
+
+    for (const TripAnalyzer* other : {&parallel, &merged}) {
+        auto a = serial.topBusySlotsInDates(100000, "2024-03-01", "2024-06-15");
+        auto b = other->topBusySlotsInDates(100000, "2024-03-01", "2024-06-15");
+        REQUIRE(!a.empty());
+        REQUIRE(a.size() == b.size());
+        for (size_t i = 0; i < a.size(); ++i) {
+            REQUIRE(a[i].zone == b[i].zone);
+            REQUIRE(a[i].hour == b[i].hour);
+            REQUIRE(a[i].count == b[i].count);
+        }
+    }
+
+    std::remove(path.c_str());
+    std::remove(snap.c_str());
+}
+
+TEST_CASE("D10", "[D][D10]") {
+    const std::string path = "d10.csv";
+    const std::string snap = "d10.snap";
+
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZONE_B,2024-01-01 07:10,1,1",
+        "2,ZONE_A,ZONE_B,2024-01-01 08:10,1,1",
+        "3,ZONE_A,ZONE_C,2024-01-01 12:00,1,1",
+        "4,ZONE_B,ZONE_A,2024-01-01 09:59,1,1",
+        "5,ZONE_B,ZONE_A,2024-01-01 10:00,1,1",
+        "6,ZONE_B, ZONE_Z ,2024-01-01 23:30,1,1",
+        "7,ZONE_C,,2024-01-01 00:30,1,1"
+    });
+
+    IngestOptions o;
+    o.trackRoutes = true;
+    TripAnalyzer ta;
+    ta.setOptions(o);
+    ta.ingestFile(path);
+
+    // Rows without a dropoff still count as pickups
+    REQUIRE(ta.ingestStats().noDropoff == 1);
+    REQUIRE(hasZone(ta.topZones(10), "ZONE_C", 1));
+    // A zone seen only as a destination is not a pickup zone
+    REQUIRE(ta.topZones(10).size() == 3);
+
+    // count desc, then pickup zone asc, then dropoff zone asc
+    auto routes = ta.topRoutes(10);
+    REQUIRE(routes.size() == 4);
+    REQUIRE(routes[0].from == "ZONE_A");
+    REQUIRE(routes[0].to == "ZONE_B");
+    REQUIRE(routes[0].count == 2);
+    REQUIRE(routes[1].from == "ZONE_B");
+    REQUIRE(routes[1].to == "ZONE_A");
+    REQUIRE(routes[2].from == "ZONE_A");
+    REQUIRE(routes[2].to == "ZONE_C");
+    REQUIRE(routes[3].from == "ZONE_B");
+    REQUIRE(routes[3].to == "ZONE_Z");
+    REQUIRE(ta.topRoutes(1).size() == 1);
+
+    auto fromB = ta.topDestinations("ZONE_B", 10);
+    REQUIRE(fromB.size() == 2);
+    REQUIRE(fromB[0].zone == "ZONE_A");
+    REQUIRE(fromB[0].count == 2);
+    REQUIRE(hasZone(fromB, "ZONE_Z", 1));
+    REQUIRE(ta.topDestinations("ZONE_C", 10).empty());
+    REQUIRE(ta.topDestinations("ZONE_Z", 10).empty());
+    REQUIRE(ta.topDestinations("ZONE_A", 0).empty());
+
+    // Routes survive a snapshot round trip
+    REQUIRE(ta.saveSnapshot(snap));
+    TripAnalyzer restored;
+    REQUIRE(restored.loadSnapshot(snap, path));
+    auto again = restored.topRoutes(10);
+    REQUIRE(again.size() == routes.size());
+    for (size_t i = 0; i < again.size(); ++i) {
+        REQUIRE(again[i].from == routes[i].from);
+        REQUIRE(again[i].to == routes[i].to);
+        REQUIRE(again[i].count == routes[i].count);
+    }
+
+    // Without trackRoutes nothing is kept
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(plain.topRoutes(10).empty());
+    REQUIRE(plain.ingestStats().noDropoff == 0);
+
+    // Parallel, streaming and merged ingests build the same pairs
+    std::ofstream out(path, std::ios::binary);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    for (int i = 0; i < 60000; ++i) {
+        char buf[96];
+        std::snprintf(buf, sizeof(buf), "%d,ZONE_%d,ZONE_%d,2024-01-01 %02d:00,1,1\n",
+                      i, (i * 7919) % 211, (i * 37) % 97, (i * 31) % 24);
+        out << buf;
+    }
+    out.close();
+
+    TripAnalyzer serial, parallel, streamed, merged;
+    serial.setOptions(o);
+    o.threads = 4;
+    parallel.setOptions(o);
+    o.threads = 1;
+    o.useMmap = false;
+    streamed.setOptions(o);
+    serial.ingestFile(path);
+    parallel.ingestFile(path);
+    streamed.ingestFile(path);
+    merged.merge(serial);
+
+    for (const TripAnalyzer* other : {&parallel, &streamed, &merged}) {
+        auto a = serial.topRoutes(100000);
+        auto b = other->topRoutes(100000);
+        REQUIRE(!a.empty());
+        REQUIRE(a.size() == b.size());
+        for (size_t i = 0; i < a.size(); ++i) {
+            REQUIRE(a[i].from == b[i].from);
+            REQUIRE(a[i].to == b[i].to);
+            REQUIRE(a[i].count == b[i].count);
+        }
+        auto da = serial.topDestinations("ZONE_5", 5);
+        auto db = other->topDestinations("ZONE_5", 5);
+        REQUIRE(da.size() == db.size());
+        for (size_t i = 0; i < da.size(); ++i) {
+            REQUIRE(da[i].zone == db[i].zone);
+            REQUIRE(da[i].count == db[i].count);
+        }
+    }
+
+    std::remove(path.c_str());
+    std::remove(snap.c_str());
+}
+
+TEST_CASE("D11", "[D][D11]") {
+    const std::string path = "d11.csv";
+    const std::string snap = "d11.snap";
+
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZX,2024-01-01 07:10,1.25,10.50",
+        "2,ZONE_A,ZX,2024-01-01 07:20,3,4.5",
+        "3,ZONE_A,ZX,2024-01-01 12:00,0.04,100",
+        "4,ZONE_B,ZX,2024-01-01 09:00,2.0,60.005",
+        "5,ZONE_B,ZX,2024-01-01 09:30,abc,60\r",
+        "6,ZONE_C,ZX,2024-01-01 09:45,1e3,",
+        "7,ZONE_D,ZX,2024-01-01 11:00,-0.5, -2.50 "
+    });
+
+    IngestOptions o;
+    o.trackMetrics = true;
+    TripAnalyzer ta;
+    ta.setOptions(o);
+    ta.ingestFile(path);
+
+    // Bad values are counted but the rows still count as trips
+    REQUIRE(ta.ingestStats().rowsAccepted == 7);
+    REQUIRE(ta.ingestStats().badDistance == 2);
+    REQUIRE(ta.ingestStats().badFare == 1);
+
+    auto a7 = ta.slotMetrics("ZONE_A", 7);
+    REQUIRE(a7.fare.n == 2);
+    REQUIRE(a7.fare.sum == 1500);
+    REQUIRE(a7.fare.min == 450);
+    REQUIRE(a7.fare.max == 1050);
+    REQUIRE(a7.fare.mean() == Catch::Approx(750.0));
+    REQUIRE(a7.distance.sum == 43);   // 1.25 rounds to 1.3
+
+    auto a = ta.zoneMetrics("ZONE_A");
+    REQUIRE(a.fare.n == 3);
+    REQUIRE(a.fare.sum == 11500);
+    REQUIRE(a.distance.min == 0);
+    REQUIRE(a.distance.max == 30);
+
+    auto b = ta.zoneMetrics("ZONE_B");
+    REQUIRE(b.fare.n == 2);
+    REQUIRE(b.fare.sum == 12001);     // 60.005 rounds to 60.01
+    REQUIRE(b.distance.n == 1);
+
+    auto d = ta.zoneMetrics("ZONE_D");
+    REQUIRE(d.fare.sum == -250);
+    REQUIRE(d.distance.sum == -5);
+
+    REQUIRE(ta.zoneMetrics("ZONE_C").fare.n == 0);
+    REQUIRE(ta.zoneMetrics("NOPE").fare.n == 0);
+    REQUIRE(ta.slotMetrics("ZONE_A", 24).fare.n == 0);
+
+    auto rz = ta.topZonesByRevenue(10);
+    REQUIRE(rz.size() == 3);
+    REQUIRE(rz[0].zone == "ZONE_B");
+    REQUIRE(rz[0].count == 12001);
+    REQUIRE(rz[1].zone == "ZONE_A");
+    REQUIRE(rz[2].zone == "ZONE_D");
+
+    auto rs = ta.topBusySlotsByRevenue(2);
+    REQUIRE(rs.size() == 2);
+    REQUIRE(rs[0].zone == "ZONE_B");
+    REQUIRE(rs[0].hour == 9);
+    REQUIRE(rs[1].zone == "ZONE_A");
+    REQUIRE(rs[1].hour == 12);
+    REQUIRE(rs[1].count == 10000);
+
+    // Metrics survive a snapshot round trip
+    REQUIRE(ta.saveSnapshot(snap));
+    TripAnalyzer restored;
+    REQUIRE(restored.loadSnapshot(snap, path));
+    auto ra = restored.zoneMetrics("ZONE_A");
+    REQUIRE(ra.fare.sum == a.fare.sum);
+    REQUIRE(ra.fare.min == a.fare.min);
+    REQUIRE(ra.distance.max == a.distance.max);
+
+    // Without trackMetrics nothing is kept
+    TripAnalyzer plain;
+    plain.ingestFile(path);
+    REQUIRE(plain.topZonesByRevenue(10).empty());
+    REQUIRE(plain.ingestStats().badFare == 0);
+
+    // Parallel, streaming and merged ingests give the same sums
+    std::ofstream out(path, std::ios::binary);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    for (int i = 0; i < 60000; ++i) {
+        char buf[96];
+        std::snprintf(buf, sizeof(buf), "%d,ZONE_%d,ZX,2024-01-01 %02d:00,%d.%d,%d.%02d\n",
+                      i, (i * 7919) % 211, (i * 31) % 24, i % 40, i % 10, i % 90, (i * 7) % 100);
+        out << buf;
+    }
+    out.close();
+
+    TripAnalyzer serial, parallel, streamed, merged;
+    serial.setOptions(o);
+    o.threads = 4;
+    parallel.setOptions(o);
+    o.threads = 1;
+    o.useMmap = false;
+    streamed.setOptions(o);
+    serial.ingestFile(path);
+    parallel.ingestFile(path);
+    streamed.ingestFile(path);
+    merged.merge(serial);
+
+    for (const TripAnalyzer* other : {&parallel, &streamed, &merged}) {
+        auto x = serial.topBusySlotsByRevenue(100000);
+        auto y = other->topBusySlotsByRevenue(100000);
+        REQUIRE(!x.empty());
+        REQUIRE(x.size() == y.size());
+        for (size_t i = 0; i < x.size(); ++i) {
+            REQUIRE(x[i].zone == y[i].zone);
+            REQUIRE(x[i].hour == y[i].hour);
+            REQUIRE(x[i].count == y[i].count);
+        }
+        auto mx = serial.zoneMetrics("ZONE_5");
+        auto my = other->zoneMetrics("ZONE_5");
+        REQUIRE(mx.distance.sum == my.distance.sum);
+        REQUIRE(mx.distance.min == my.distance.min);
+        REQUIRE(mx.fare.max == my.fare.max);
+    }
+
+    std::remove(path.c_str());
+    std::remove(snap.c_str());
+}
+
+TEST_CASE("D12", "[D][D12]") {
+    const std::string path = "d12.csv";
+
+    // Five heavy zones over a long tail of one-trip zones
+    std::ofstream out(path, std::ios::binary);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    for (int i = 0; i < 60000; ++i) {
+        char buf[96];
+        if (i % 3 == 0)
+            std::snprintf(buf, sizeof(buf), "%d,HOT_%d,ZX,2024-01-01 %02d:00,1,1\n",
+                          i, (i / 3) % 5, 8 + (i / 15) % 3);
+        else
+            std::snprintf(buf, sizeof(buf), "%d,TAIL_%d,ZX,2024-01-01 %02d:00,1,1\n",
+                          i, i, (i * 7) % 24);
+        out << buf;
+    }
+    out.close();
+
+    TripAnalyzer exact;
+    exact.ingestFile(path);
+    REQUIRE(!exact.approximate());
+    auto exactZones = exact.topZones(5);
+    auto exactSlots = exact.topBusySlots(15);
+
+    // Exact mode reports zero error
+    for (const auto& e : exact.estimateTopZones(5)) REQUIRE(e.error == 0);
+
+    auto checkBounds = [&](const TripAnalyzer& ta) {
+        REQUIRE(ta.approximate());
+        auto zones = ta.estimateTopZones(5);
+        REQUIRE(zones.size() == 5);
+        for (size_t i = 0; i < zones.size(); ++i) {
+            REQUIRE(zones[i].zone == exactZones[i].zone);
+            REQUIRE(zones[i].count >= exactZones[i].count);
+            REQUIRE(zones[i].count - zones[i].error <= exactZones[i].count);
+        }
+        auto slots = ta.estimateTopBusySlots(15);
+        REQUIRE(slots.size() == 15);
+        for (const auto& s : slots) {
+            REQUIRE(s.zone.rfind("HOT_", 0) == 0);
+            REQUIRE(s.count >= 1333);
+            REQUIRE(s.count - s.error <= 1334);
+        }
+        auto plain = ta.topZones(5);
+        REQUIRE(plain.size() == 5);
+        REQUIRE(plain[0].zone == zones[0].zone);
+        REQUIRE(plain[0].count == zones[0].count);
+    };
+
+    IngestOptions o;
+    o.approxEntries = 256;
+    TripAnalyzer approx;
+    approx.setOptions(o);
+    approx.ingestFile(path);
+    checkBounds(approx);
+
+    // Only the summaries are kept
+    REQUIRE(approx.topZones(10, 0, 23).empty());
+    REQUIRE(!approx.saveSnapshot("d12.snap"));
+
+    o.threads = 4;
+    TripAnalyzer parallel;
+    parallel.setOptions(o);
+    parallel.ingestFile(path);
+    checkBounds(parallel);
+
+    // Exact into approximate and approximate into exact
+    TripAnalyzer a, b;
+    a.merge(approx);
+    a.merge(exact);
+    b.merge(exact);
+    b.merge(approx);
+    for (const TripAnalyzer* m : {&a, &b}) {
+        auto zones = m->estimateTopZones(5);
+        REQUIRE(zones.size() == 5);
+        for (size_t i = 0; i < zones.size(); ++i) {
+            REQUIRE(zones[i].zone == exactZones[i].zone);
+            REQUIRE(zones[i].count >= 2 * exactZones[i].count);
+            REQUIRE(zones[i].count - zones[i].error <= 2 * exactZones[i].count);
+        }
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D13", "[D][D13]") {
+    const std::string path = "d13.csv";
+    const std::string snap = "d13.snap";
+
+    // ZONE_A stays in the inline form, ZONE_B needs a counter block
+    writeFile(path, {
+        HDR,
+        "1,ZONE_A,ZX,2024-01-01 07:10,1,1",
+        "2,ZONE_A,ZX,2024-01-01 07:20,1,1",
+        "3,ZONE_A,ZX,2024-01-01 09:00,1,1",
+        "4,ZONE_B,ZX,2024-01-01 01:00,1,1",
+        "5,ZONE_B,ZX,2024-01-01 05:00,1,1",
+        "6,ZONE_B,ZX,2024-01-01 12:00,1,1",
+        "7,ZONE_B,ZX,2024-01-01 18:00,1,1",
+        "8,ZONE_B,ZX,2024-01-01 23:00,1,1"
+    });
+
+    TripAnalyzer a, b;
+    a.ingestFile(path);
+    b.ingestFile(path);
+
+    // Merging back and forth grows the counts like Fibonacci numbers,
+    // well past 32 bits; every count is a multiple of its single-file value.
+    long long fa = 1, fb = 1;
+    for (int i = 0; i < 30; ++i) {
+        a.merge(b);
+        fa += fb;
+        b.merge(a);
+        fb += fa;
+    }
+    REQUIRE(fb > (1LL << 32) * 4);
+
+    auto zones = b.topZones(10);
+    REQUIRE(zones.size() == 2);
+    REQUIRE(zones[0].zone == "ZONE_B");
+    REQUIRE(zones[0].count == 5 * fb);
+    REQUIRE(zones[1].count == 3 * fb);
+
+    auto slots = b.topBusySlots(10);
+    REQUIRE(slots.size() == 7);
+    REQUIRE(slots[0].zone == "ZONE_A");
+    REQUIRE(slots[0].hour == 7);
+    REQUIRE(slots[0].count == 2 * fb);
+    REQUIRE(hasSlot(slots, "ZONE_B", 23, fb));
+    REQUIRE(hasZone(b.topZones(10, 5, 12), "ZONE_B", 2 * fb));
+
+    REQUIRE(b.saveSnapshot(snap));
+    TripAnalyzer restored;
+    REQUIRE(restored.loadSnapshot(snap, ""));
+    auto again = restored.topBusySlots(10);
+    REQUIRE(again.size() == slots.size());
+    for (size_t i = 0; i < again.size(); ++i) {
+        REQUIRE(again[i].zone == slots[i].zone);
+        REQUIRE(again[i].hour == slots[i].hour);
+        REQUIRE(again[i].count == slots[i].count);
+    }
+
+    std::remove(path.c_str());
+    std::remove(snap.c_str());
+}
+
+TEST_CASE("D14", "[D][D14]") {
+    const std::string path = "d14.csv";
+
+    // About 3 MiB: dirty rows, CRLF, a line longer than a read block, and
+    // no newline after the last row
+    std::string data = std::string(HDR) + "\r\n";
+    for (int i = 0; i < 60000; ++i) {
+        char buf[96];
+        std::snprintf(buf, sizeof(buf), "%d,ZONE_%d,ZX,2024-01-01 %02d:00,1,1%s\n",
+                      i, (i * 7919) % 211, (i * 31) % 24, i % 3 ? "" : "\r");
+        data += buf;
+        if (i == 20000) data += "x,ZONE_LONG,ZX,2024-01-01 05:00,1," + std::string(1 << 21, '9') + "\n";
+        if (i % 1000 == 7) data += "bad row\n\n";
+    }
+    data += "last,ZONE_END,ZX,2024-01-01 06:00,1,1";
+    {
+        std::ofstream out(path, std::ios::binary);
+        REQUIRE(out.is_open());
+        out << data;
+    }
+
+    TripAnalyzer fromFile;
+    fromFile.ingestFile(path);
+
+    auto same = [&](const TripAnalyzer& ta) {
+        auto a = fromFile.topBusySlots(100000);
+        auto b = ta.topBusySlots(100000);
+        REQUIRE(a.size() == b.size());
+        for (size_t i = 0; i < a.size(); ++i) {
+            REQUIRE(a[i].zone == b[i].zone);
+            REQUIRE(a[i].hour == b[i].hour);
+            REQUIRE(a[i].count == b[i].count);
+        }
+        IngestStats x = fromFile.ingestStats(), y = ta.ingestStats();
+        REQUIRE(x.bytesRead == y.bytesRead);
+        REQUIRE(x.rows == y.rows);
+        REQUIRE(x.rowsAccepted == y.rowsAccepted);
+        REQUIRE(x.blankLines == y.blankLines);
+        REQUIRE(x.tooFewFields == y.tooFewFields);
+    };
+
+    REQUIRE(hasZone(fromFile.topZones(300), "ZONE_LONG", 1));
+    REQUIRE(hasZone(fromFile.topZones(300), "ZONE_END", 1));
+    REQUIRE(fromFile.ingestStats().bytesRead == data.size());
+
+    std::istringstream in(data);
+    TripAnalyzer fromStream;
+    fromStream.ingestStream(in);
+    same(fromStream);
+
+    IngestOptions o;
+    o.useMmap = false;
+    TripAnalyzer unmapped;
+    unmapped.setOptions(o);
+    unmapped.ingestFile(path);
+    same(unmapped);
+
+    // A pipe hands data over in small pieces
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    std::thread writer([&] {
+        for (size_t off = 0; off < data.size();) {
+            ssize_t n = write(fds[1], data.data() + off, std::min<size_t>(4093, data.size() - off));
+            if (n <= 0) break;
+            off += (size_t)n;
+        }
+        close(fds[1]);
+    });
+    TripAnalyzer fromPipe;
+    REQUIRE(fromPipe.ingestFd(fds[0]));
+    writer.join();
+    close(fds[0]);
+    same(fromPipe);
+    REQUIRE(fromPipe.ingestStats().readErrors == 0);
+
+    // Header only, and nothing at all
+    std::istringstream hdrOnly(std::string(HDR) + "\n"), empty("");
+    TripAnalyzer h, e;
+    h.ingestStream(hdrOnly);
+    e.ingestStream(empty);
+    REQUIRE(h.topZones(10).empty());
+    REQUIRE(h.ingestStats().rows == 0);
+    REQUIRE(e.ingestStats().rows == 0);
+
+    // A failed read is reported, not taken for the end of the input
+    int dirFd = open(".", O_RDONLY);
+    REQUIRE(dirFd >= 0);
+    TripAnalyzer bad;
+    REQUIRE(!bad.ingestFd(dirFd));
+    REQUIRE(bad.ingestStats().readErrors == 1);
+    REQUIRE(bad.ingestStats().rows == 0);
+    close(dirFd);
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D15", "[D][D15]") {
+    // About 9 MiB so the pipeline has many blocks in flight, with a line
+    // that spans several of them
+    std::string data = std::string(HDR) + "\n";
+    for (int i = 0; i < 200000; ++i) {
+        char buf[128];
+        std::snprintf(buf, sizeof(buf), "%d,ZONE_%d,ZONE_%d,2024-01-%02d %02d:00,%d.%d,%d.25\n",
+                      i, (i * 7919) % 997, (i * 13) % 89, 1 + i % 28, (i * 31) % 24,
+                      i % 40, i % 10, 5 + i % 60);
+        data += buf;
+        if (i == 90000) data += "x,ZONE_LONG,ZX,2024-01-01 05:00,1," + std::string(3 << 20, '9') + "\n";
+        if (i % 5000 == 3) data += "bad row\n\n";
+    }
+
+    IngestOptions o;
+    o.trackDates = o.trackRoutes = o.trackMetrics = true;
+    std::istringstream serialIn(data);
+    TripAnalyzer serial;
+    serial.setOptions(o);
+    serial.ingestStream(serialIn);
+
+    auto same = [&](const TripAnalyzer& ta) {
+        auto a = serial.topBusySlots(100000);
+        auto b = ta.topBusySlots(100000);
+        REQUIRE(a.size() == b.size());
+        for (size_t i = 0; i < a.size(); ++i) {
+            REQUIRE(a[i].zone == b[i].zone);
+            REQUIRE(a[i].hour == b[i].hour);
+            REQUIRE(a[i].count == b[i].count);
+        }
+        auto ra = serial.topRoutes(100000);
+        auto rb = ta.topRoutes(100000);
+        REQUIRE(ra.size() == rb.size());
+        for (size_t i = 0; i < ra.size(); ++i) {
+            REQUIRE(ra[i].from == rb[i].from);
+            REQUIRE(ra[i].to == rb[i].to);
+            REQUIRE(ra[i].count == rb[i].count);
+        }
+        auto da = serial.topZonesInDates(50, "2024-01-03", "2024-01-09");
+        auto db = ta.topZonesInDates(50, "2024-01-03", "2024-01-09");
+        REQUIRE(da.size() == db.size());
+        for (size_t i = 0; i < da.size(); ++i) {
+            REQUIRE(da[i].zone == db[i].zone);
+            REQUIRE(da[i].count == db[i].count);
+        }
+        TripMetrics ma = serial.zoneMetrics("ZONE_5"), mb = ta.zoneMetrics("ZONE_5");
+        REQUIRE(ma.fare.n == mb.fare.n);
+        REQUIRE(ma.fare.sum == mb.fare.sum);
+        REQUIRE(ma.distance.sum == mb.distance.sum);
+        REQUIRE(ma.distance.max == mb.distance.max);
+
+        IngestStats x = serial.ingestStats(), y = ta.ingestStats();
+        REQUIRE(x.bytesRead == y.bytesRead);
+        REQUIRE(x.rows == y.rows);
+        REQUIRE(x.rowsAccepted == y.rowsAccepted);
+        REQUIRE(x.blankLines == y.blankLines);
+        REQUIRE(x.tooFewFields == y.tooFewFields);
+        REQUIRE(x.badFare == y.badFare);
+    };
+    REQUIRE(hasZone(serial.topZones(2000), "ZONE_LONG", 1));
+
+    o.threads = 4;
+    std::istringstream in(data);
+    TripAnalyzer piped;
+    piped.setOptions(o);
+    piped.ingestStream(in);
+    same(piped);
+
+    // A pipe in small pieces, more workers than blocks can keep busy
+    o.threads = 16;
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    std::thread writer([&] {
+        for (size_t off = 0; off < data.size();) {
+            ssize_t n = write(fds[1], data.data() + off, std::min<size_t>(65521, data.size() - off));
+            if (n <= 0) break;
+            off += (size_t)n;
+        }
+        close(fds[1]);
+    });
+    TripAnalyzer fromPipe;
+    fromPipe.setOptions(o);
+    fromPipe.ingestFd(fds[0]);
+    writer.join();
+    close(fds[0]);
+    same(fromPipe);
+
+    // Header only and empty input with the pipeline on
+    std::istringstream hdrOnly(std::string(HDR) + "\n"), empty("");
+    TripAnalyzer h, e;
+    h.setOptions(o);
+    e.setOptions(o);
+    h.ingestStream(hdrOnly);
+    e.ingestStream(empty);
+    REQUIRE(h.topZones(10).empty());
+    REQUIRE(h.ingestStats().rows == 0);
+    REQUIRE(e.ingestStats().rows == 0);
+}
+
+TEST_CASE("D16", "[D][D16]") {
+    const std::string path = "d16.csv";
+
+    // About 12 MiB with all the expensive rows up front: a hot zone with
+    // long rows, then a dirty stretch, then cheap rows. A static split
+    // would leave the first worker with most of the work.
+    std::ofstream out(path, std::ios::binary);
+    REQUIRE(out.is_open());
+    out << HDR << "\n";
+    std::string pad(1500, '7');
+    for (int i = 0; i < 4000; ++i)
+        out << i << ",ZONE_BIG,ZX,2024-01-01 " << (i % 24 < 10 ? "0" : "") << i % 24 << ":00,1," << pad << "\n";
+    for (int i = 0; i < 40000; ++i)
+        out << (i % 3 ? "garbage,,\n" : "\n") << i << ",ZONE_BIG,ZX,2024-01-01 99:00,1,1\n";
+    for (int i = 0; i < 120000; ++i) {
+        char buf[96];
+        std::snprintf(buf, sizeof(buf), "%d,ZONE_%d,ZX,2024-01-01 %02d:00,1,1\n",
+                      i, (i * 7919) % 5003, (i * 31) % 24);
+        out << buf;
+    }
+    out.close();
+
+    TripAnalyzer serial;
+    serial.ingestFile(path);
+    REQUIRE(hasZone(serial.topZones(1), "ZONE_BIG", 4000));
+
+    for (int t : {2, 3, 8}) {
+        IngestOptions o;
+        o.threads = t;
+        TripAnalyzer parallel;
+        parallel.setOptions(o);
+        parallel.ingestFile(path);
+        REQUIRE(sameResults(serial, parallel, 1000000));
+
+        IngestStats x = serial.ingestStats(), y = parallel.ingestStats();
+        REQUIRE(x.rows == y.rows);
+        REQUIRE(x.rowsAccepted == y.rowsAccepted);
+        REQUIRE(x.blankLines == y.blankLines);
+        REQUIRE(x.tooFewFields == y.tooFewFields);
+        REQUIRE(x.hourOutOfRange == y.hourOutOfRange);
+    }
+
+    // The approximate mode splits the same way on every run
+    IngestOptions o;
+    o.threads = 4;
+    o.approxEntries = 64;
+    TripAnalyzer a, b;
+    a.setOptions(o);
+    b.setOptions(o);
+    a.ingestFile(path);
+    b.ingestFile(path);
+    auto ea = a.estimateTopZones(64), eb = b.estimateTopZones(64);
+    REQUIRE(ea.size() == eb.size());
+    for (size_t i = 0; i < ea.size(); ++i) {
+        REQUIRE(ea[i].zone == eb[i].zone);
+        REQUIRE(ea[i].count == eb[i].count);
+        REQUIRE(ea[i].error == eb[i].error);
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D17", "[D][D17]") {
+    const std::string dir = "d17_dir";
+    REQUIRE(mkdir(dir.c_str(), 0755) == 0);
+    REQUIRE(mkdir((dir + "/sub.csv").c_str(), 0755) == 0);
+
+    // Files from empty to a few MiB, each with its own header except one,
+    // a CRLF header, and a file whose last row has no newline. all.csv is
+    // the same rows in one file.
+    std::string all = std::string(HDR) + "\n";
+    std::vector<std::string> names;
+    int row = 0;
+    for (int f = 0; f < 30; ++f) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "trips_%02d.csv", f);
+        names.push_back(dir + "/" + name);
+        std::string body;
+        int rows = f == 7 ? 0 : (f * f * 53) % 40000 + (f == 11 ? 90000 : 0);
+        for (int i = 0; i < rows; ++i, ++row) {
+            char buf[96];
+            std::snprintf(buf, sizeof(buf), "%d,ZONE_%d,ZX,2024-01-01 %02d:00,1,1\n",
+                          row, row % 1201 * 7919 % 1201, row % 24 * 31 % 24);
+            body += buf;
+        }
+        if (f == 3) body += "bad row\n\n";
+        all += body;
+        if (f == 5 && !body.empty()) body.pop_back();
+        std::ofstream out(names.back(), std::ios::binary);
+        if (f == 9) out << HDR << "\r\n";
+        else if (f != 12) out << HDR << "\n";
+        out << body;
+    }
+    std::ofstream(dir + "/notes.txt") << HDR << "\n1,ZONE_NOTES,ZX,2024-01-01 01:00,1,1\n";
+    std::ofstream("d17_all.csv", std::ios::binary) << all;
+
+    TripAnalyzer whole;
+    whole.ingestFile("d17_all.csv");
+
+    IngestOptions o;
+    o.threads = 4;
+    TripAnalyzer fromDir, fromList, unmapped;
+    fromDir.setOptions(o);
+    fromDir.ingestDirectory(dir);
+    REQUIRE(sameResults(whole, fromDir, 1000000));
+    REQUIRE(fromDir.ingestStats().filesRead == 30);
+    REQUIRE(fromDir.ingestStats().filesFailed == 0);
+    REQUIRE(fromDir.ingestStats().rowsAccepted == whole.ingestStats().rowsAccepted);
+    REQUIRE(fromDir.ingestStats().tooFewFields == whole.ingestStats().tooFewFields);
+
+    std::vector<std::string> list = names;
+    list.push_back(dir + "/missing.csv");
+    fromList.setOptions(o);
+    fromList.ingestFiles(list);
+    REQUIRE(sameResults(whole, fromList, 1000000));
+    REQUIRE(fromList.ingestStats().filesFailed == 1);
+
+    o.useMmap = false;
+    unmapped.setOptions(o);
+    unmapped.ingestFiles(names);
+    REQUIRE(sameResults(whole, unmapped, 1000000));
+
+    // Each call replaces the previous result; no match means no counts
+    TripAnalyzer notes;
+    notes.ingestDirectory(dir, "*.txt");
+    REQUIRE(hasZone(notes.topZones(5), "ZONE_NOTES", 1));
+    notes.ingestDirectory(dir, "*.none");
+    REQUIRE(notes.topZones(5).empty());
+    REQUIRE(notes.ingestStats().filesRead == 0);
+
+    // The approximate mode assigns files the same way every run
+    o.approxEntries = 32;
+    TripAnalyzer a, b;
+    a.setOptions(o);
+    b.setOptions(o);
+    a.ingestFiles(names);
+    b.ingestFiles(names);
+    auto ea = a.estimateTopZones(32), eb = b.estimateTopZones(32);
+    REQUIRE(ea.size() == eb.size());
+    for (size_t i = 0; i < ea.size(); ++i) {
+        REQUIRE(ea[i].zone == eb[i].zone);
+        REQUIRE(ea[i].count == eb[i].count);
+    }
+
+    for (const auto& n : names) std::remove(n.c_str());
+    std::remove((dir + "/notes.txt").c_str());
+    rmdir((dir + "/sub.csv").c_str());
+    rmdir(dir.c_str());
+    std::remove("d17_all.csv");
+}
+
+TEST_CASE("D18", "[D][D18]") {
+    const std::string path = "d18.csv";
+    auto rows = [](int from, int to) {
+        std::string s;
+        for (int i = from; i < to; ++i) {
+            char buf[96];
+            std::snprintf(buf, sizeof(buf), "%d,ZONE_%d,ZX,2024-01-01 %02d:00,1,1\n",
+                          i, (i * 7919) % 307, (i * 31) % 24);
+            s += buf;
+        }
+        return s;
+    };
+    auto appendText = [&](const std::string& s) {
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        out << s;
+    };
+    // The whole file as ingestFile sees it, minus an unfinished last line
+    auto expected = [&](const std::string& text) {
+        std::ofstream("d18_ref.csv", std::ios::binary) << text.substr(0, text.rfind('\n') + 1);
+        TripAnalyzer ref;
+        ref.ingestFile("d18_ref.csv");
+        std::remove("d18_ref.csv");
+        return ref;
+    };
+
+    std::remove(path.c_str());
+    TripAnalyzer ta;
+    REQUIRE(!ta.appendFrom(path));
+    REQUIRE(ta.ingestStats().filesFailed == 1);
+
+    // The last line is still being written
+    std::string text = std::string(HDR) + "\n" + rows(0, 5000) + "5000,ZONE_PART";
+    appendText(text);
+    REQUIRE(ta.appendFrom(path));
+    REQUIRE(sameResults(ta, expected(text), 1000));
+    REQUIRE(ta.ingestStats().rows == 5000);
+
+    // Only the new bytes are read, the finished line included
+    std::string more = ",ZX,2024-01-01 03:00,1,1\n" + rows(5001, 60000) + "bad row\n";
+    appendText(more);
+    text += more;
+    IngestOptions o;
+    o.threads = 4;
+    ta.setOptions(o);
+    REQUIRE(ta.appendFrom(path));
+    REQUIRE(sameResults(ta, expected(text), 1000));
+    REQUIRE(hasZone(ta.topZones(1000), "ZONE_PART", 1));
+    REQUIRE(ta.ingestStats().bytesRead == more.size() + 14);
+    REQUIRE(ta.ingestStats().rows == 55001);
+    REQUIRE(ta.ingestStats().tooFewFields == 1);
+
+    REQUIRE(ta.appendFrom(path));
+    REQUIRE(ta.ingestStats().rows == 0);
+    REQUIRE(sameResults(ta, expected(text), 1000));
+
+    // Rotated: a new file at the same path is read from its start, and its
+    // counts add to what was there
+    std::string rotated = std::string(HDR) + "\n" + rows(0, 300);
+    std::rename(path.c_str(), "d18.csv.1");
+    appendText(rotated);
+    REQUIRE(ta.appendFrom(path));
+    TripAnalyzer both = expected(text);
+    both.merge(expected(rotated));
+    REQUIRE(sameResults(ta, both, 1000));
+    std::remove("d18.csv.1");
+
+    // An ingest replaces the counts, and appending carries on where it
+    // stopped instead of counting the file again
+    ta.ingestFile(path);
+    REQUIRE(ta.appendFrom(path));
+    REQUIRE(ta.ingestStats().rows == 0);
+    REQUIRE(sameResults(ta, expected(rotated), 1000));
+    appendText(rows(300, 340));
+    REQUIRE(ta.appendFrom(path));
+    REQUIRE(ta.ingestStats().rows == 40);
+    REQUIRE(sameResults(ta, expected(rotated + rows(300, 340)), 1000));
+
+    // The same through ingestFiles, with rankings cached before the append
+    TripAnalyzer many;
+    many.ingestFiles({path, path});
+    REQUIRE(many.topZones(5).size() == 5);
+    REQUIRE(many.topBusySlots(5).size() == 5);
+    appendText(rows(340, 400));
+    REQUIRE(many.appendFrom(path));
+    REQUIRE(many.ingestStats().rows == 60);
+    TripAnalyzer twice = expected(rotated + rows(300, 340));
+    twice.merge(expected(rotated + rows(300, 400)));
+    REQUIRE(sameResults(many, twice, 5));
+    REQUIRE(sameResults(many, twice, 1000));
+
+    // An ingest counts a last row with no newline; appending once the
+    // newline arrives does not count it again
+    std::remove(path.c_str());
+    text = std::string(HDR) + "\n" + rows(0, 100);
+    text.pop_back();
+    appendText(text);
+    TripAnalyzer ingested, listed;
+    ingested.ingestFile(path);
+    listed.ingestFiles({path});
+    REQUIRE(ingested.ingestStats().rows == 100);
+    REQUIRE(ingested.appendFrom(path));
+    REQUIRE(ingested.ingestStats().rows == 0);
+    more = "\n" + rows(100, 130);
+    appendText(more);
+    text += more;
+    REQUIRE(ingested.appendFrom(path));
+    REQUIRE(ingested.ingestStats().rows == 30);
+    REQUIRE(listed.appendFrom(path));
+    REQUIRE(listed.ingestStats().rows == 30);
+    REQUIRE(sameResults(ingested, expected(text), 1000));
+    REQUIRE(sameResults(listed, expected(text), 1000));
+
+    // Follow a file while another thread writes it in bursts
+    std::remove(path.c_str());
+    text = std::string(HDR) + "\n";
+    appendText(text);
+    std::thread writer([&] {
+        for (int burst = 0; burst < 5; ++burst) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            std::string r = rows(burst * 1000, burst * 1000 + 1000);
+            appendText(r.substr(0, 500));
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            appendText(r.substr(500));
+        }
+    });
+    TripAnalyzer live;
+    unsigned long long accepted = 0;
+    int updates = 0;
+    live.follow(path, [&](const IngestStats& st) {
+        accepted += st.rowsAccepted;
+        return accepted < 5000 && ++updates < 1000;
+    }, 20);
+    writer.join();
+    for (int burst = 0; burst < 5; ++burst) text += rows(burst * 1000, burst * 1000 + 1000);
+    REQUIRE(sameResults(live, expected(text), 1000));
+
+    std::remove(path.c_str());
+}
+
+// Minimal client for the server's line protocol: sends request lines, reads
+// one reply ("OK n" plus n lines, or an ERR line) per call.
+struct LineClient {
+    int fd = -1;
+    std::string buf;
+
+    explicit LineClient(const std::string& path) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        for (int tries = 0; tries < 200; ++tries) {
+            if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        close(fd);
+        fd = -1;
+    }
+    ~LineClient() { if (fd >= 0) close(fd); }
+
+    void send(const std::string& text) { REQUIRE(write(fd, text.data(), text.size()) == (ssize_t)text.size()); }
+
+    std::string line() {
+        size_t nl;
+        while ((nl = buf.find('\n')) == std::string::npos) {
+            char tmp[4096];
+            ssize_t n = read(fd, tmp, sizeof(tmp));
+            if (n <= 0) return "<eof>";
+            buf.append(tmp, (size_t)n);
+        }
+        std::string l = buf.substr(0, nl);
+        buf.erase(0, nl + 1);
+        return l;
+    }
+
+    std::vector<std::string> reply() {
+        std::vector<std::string> v{line()};
+        if (v[0].compare(0, 3, "OK ") == 0)
+            for (int n = std::stoi(v[0].substr(3)); n > 0; --n) v.push_back(line());
+        return v;
+    }
+};
+
+TEST_CASE("D19", "[D][D19]") {
+    const std::string sock = "d19.sock";
+    const std::string path = "d19.csv", path2 = "d19b.csv", fifo = "d19.fifo";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << HDR << "\n";
+        for (int i = 0; i < 3000; ++i)
+            out << i << ",ZONE " << i % 17 << ",ZX,2024-01-01 " << (i % 24 < 10 ? "0" : "") << i % 24 << ":00,1,1\n";
+    }
+
+    // Streamed, so that the reload of a FIFO below opens it exactly once
+    auto ta = std::make_unique<TripAnalyzer>();
+    IngestOptions o;
+    o.useMmap = false;
+    ta->setOptions(o);
+    ta->ingestFile(path);
+    TripAnalyzer ref;
+    ref.ingestFile(path);
+    TripServer srv(std::move(ta));
+    REQUIRE(srv.listen(sock));
+    std::thread loop([&] { srv.run(); });
+
+    {
+        LineClient c(sock);
+        REQUIRE(c.fd >= 0);
+
+        // Pipelined requests are answered in order
+        c.send("PING\nZONES 3\nSLOTS 2\nZONE ZONE 5\nSLOT 7 ZONE 7\nSLOT 24 ZONE 7\nZONES x\nNOPE\n");
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 0"});
+        auto zones = c.reply();
+        auto top = ref.topZones(3);
+        REQUIRE(zones.size() == 4);
+        for (int i = 0; i < 3; ++i) REQUIRE(zones[i + 1] == top[i].zone + "," + std::to_string(top[i].count));
+        auto slots = c.reply();
+        auto topSlots = ref.topBusySlots(2);
+        REQUIRE(slots.size() == 3);
+        REQUIRE(slots[1] == topSlots[0].zone + "," + std::to_string(topSlots[0].hour) + "," +
+                            std::to_string(topSlots[0].count));
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 1", std::to_string(ref.zoneCount("ZONE 5"))});
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 1", std::to_string(ref.slotCount("ZONE 7", 7))});
+        REQUIRE(c.reply()[0].compare(0, 3, "ERR") == 0);
+        REQUIRE(c.reply()[0].compare(0, 3, "ERR") == 0);
+        REQUIRE(c.reply()[0].compare(0, 3, "ERR") == 0);
+        c.send("ZONES 2147483647\nSLOTS 2147483647\n");
+        REQUIRE(c.reply().size() == 1 + 17);
+        REQUIRE(c.reply().size() == 1 + ref.topBusySlots(1000).size());
+
+        // A second client meanwhile, then a reload it can see
+        LineClient other(sock);
+        other.send("ZONE ZONE 1\n");
+        REQUIRE(other.reply()[1] == std::to_string(ref.zoneCount("ZONE 1")));
+
+        {
+            std::ofstream out(path2, std::ios::binary);
+            out << HDR << "\n1,ZONE_NEW,ZX,2024-01-01 03:00,1,1\n";
+        }
+        // A request behind a RELOAD waits for it and sees the new data
+        c.send("RELOAD " + path + " " + path2 + "\nZONE ZONE_NEW\n");
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 1", "rows=3001 files=2 failed=0"});
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 1", "1"});
+        other.send("ZONE ZONE_NEW\nZONE ZONE 1\n");
+        REQUIRE(other.reply()[1] == "1");
+        REQUIRE(other.reply()[1] == std::to_string(ref.zoneCount("ZONE 1")));
+
+        // Appended lines show up without a reload
+        {
+            std::ofstream out(path2, std::ios::binary | std::ios::app);
+            out << "2,ZONE_NEW,ZX,2024-01-01 03:00,1,1\n";
+        }
+        c.send("APPEND " + path2 + "\nAPPEND " + path2 + "\nSLOT 3 ZONE_NEW\n");
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 1", "rows=1"});   // after the reload's rows
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 1", "rows=0"});
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 1", "2"});
+
+        // While a reload is held up on a FIFO, others are still answered but
+        // may not append to the analyzer about to be replaced
+        std::remove(fifo.c_str());
+        REQUIRE(mkfifo(fifo.c_str(), 0600) == 0);
+        c.send("RELOAD " + path + " " + path2 + " " + fifo + "\nZONE ZONE_NEW\n");
+        other.send("APPEND " + path2 + "\nPING\n");
+        REQUIRE(other.reply() == std::vector<std::string>{"ERR reload in progress"});
+        REQUIRE(other.reply() == std::vector<std::string>{"OK 0"});
+        int fd = open(fifo.c_str(), O_WRONLY);
+        REQUIRE(fd >= 0);
+        std::string header = std::string(HDR) + "\n";
+        REQUIRE(write(fd, header.data(), header.size()) == (ssize_t)header.size());
+        close(fd);
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 1", "rows=3002 files=3 failed=0"});
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 1", "2"});
+
+        // Replies to a client that does not read pile up to a bound, then
+        // its requests wait; none are lost or reordered
+        std::string flood;
+        for (int i = 0; i < 4000; ++i) flood += "SLOTS 50\n";
+        c.send(flood + "PING\n");
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        other.send("ZONE ZONE 1\n");
+        REQUIRE(other.reply()[1] == std::to_string(ref.zoneCount("ZONE 1")));
+        auto first = c.reply();
+        REQUIRE(first.size() == 51);
+        for (int i = 1; i < 4000; ++i) REQUIRE(c.reply() == first);
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 0"});
+
+        // A reload that reads nothing, or not every file, keeps the old data
+        mkdir("d19_empty", 0700);
+        c.send("RELOAD d19_missing.csv\nRELOAD " + path + " d19_missing.csv\nRELOAD d19_empty\n"
+               "ZONE ZONE_NEW\nSTATS\n");
+        REQUIRE(c.reply() == std::vector<std::string>{"ERR reload failed, old data kept: files=0 failed=1"});
+        REQUIRE(c.reply() == std::vector<std::string>{"ERR reload failed, old data kept: files=1 failed=1"});
+        REQUIRE(c.reply() == std::vector<std::string>{"ERR reload failed, old data kept: files=0 failed=0"});
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 1", "2"});
+        REQUIRE(c.reply()[1].find(" generation=2 ") != std::string::npos);
+        rmdir("d19_empty");
+
+        other.send("QUIT\nPING\n");
+        REQUIRE(other.line() == "<eof>");
+
+        c.send("SHUTDOWN\n");
+        REQUIRE(c.reply() == std::vector<std::string>{"OK 0"});
+    }
+    loop.join();
+    REQUIRE(srv.analyzer().zoneCount("ZONE_NEW") == 2);
+    REQUIRE(access(sock.c_str(), F_OK) != 0);
+
+    std::remove(path.c_str());
+    std::remove(path2.c_str());
+    std::remove(fifo.c_str());
+}
+
+TEST_CASE("D20", "[D][D20]") {
+    ZoneDictionary d;
+    REQUIRE(d.find("") == ZoneDictionary::npos);
+    REQUIRE(d.find("ZONE_1") == ZoneDictionary::npos);
+
+    // Ids in first-seen order; a repeat gets its old id back
+    REQUIRE(d.intern("ZONE_1") == 0);
+    REQUIRE(d.intern("ZONE_2") == 1);
+    REQUIRE(d.intern("ZONE_1") == 0);
+    REQUIRE(d.intern("") == 2);
+    REQUIRE(d.find("") == 2);
+
+    // Keys past the inline bytes are told apart by the stored names,
+    // including ones that agree on every inline byte and in length
+    const std::string prefix(20, 'P');
+    const std::string longA = prefix + "_A", longB = prefix + "_B", longer = prefix + "_A_MORE";
+    REQUIRE(d.intern(longA) == 3);
+    REQUIRE(d.intern(longB) == 4);
+    REQUIRE(d.intern(longer) == 5);
+    REQUIRE(d.intern(prefix) == 6);
+    REQUIRE(d.find(longA) == 3);
+    REQUIRE(d.find(longB) == 4);
+    REQUIRE(d.find(longer) == 5);
+    REQUIRE(d.find(prefix) == 6);
+    REQUIRE(d.name(4) == longB);
+
+    // Misses: prefixes, extensions and near neighbours of present keys
+    for (const std::string& miss : {std::string("ZONE_"), std::string("ZONE_12"), std::string("ZONE_3"),
+                                    prefix + "_C", prefix + "_", longA + "X", prefix.substr(1)})
+        REQUIRE(d.find(miss) == ZoneDictionary::npos);
+
+    // Many resizes later every key still maps to its id, and nothing moved
+    std::vector<std::string> keys;
+    for (int i = 0; i < 100000; ++i)
+        keys.push_back(i % 3 ? "Z" + std::to_string(i) : prefix + std::to_string(i));
+    for (size_t i = 0; i < keys.size(); ++i) REQUIRE(d.intern(keys[i]) == i + 7);
+    REQUIRE(d.size() == keys.size() + 7);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        REQUIRE(d.find(keys[i]) == i + 7);
+        REQUIRE(d.name((uint32_t)(i + 7)) == keys[i]);
+    }
+    REQUIRE(d.find(longB) == 4);
+    REQUIRE(d.find("Z100000") == ZoneDictionary::npos);
+    REQUIRE(d.find(prefix + "100002") == ZoneDictionary::npos);
+
+    // A copy answers like the original; clear forgets everything
+    ZoneDictionary copy = d;
+    REQUIRE(copy.find(keys[99999]) == 100006);
+    d.clear();
+    REQUIRE(d.empty());
+    REQUIRE(d.find("ZONE_1") == ZoneDictionary::npos);
+    REQUIRE(d.intern(longA) == 0);
+}
+
+TEST_CASE("D21", "[D][D21]") {
+    // Count descending, then name: many equal counts, so ties decide
+    using Item = std::pair<int, std::string>;
+    auto before = [](const Item& a, const Item& b) {
+        if (a.first != b.first) return a.first > b.first;
+        return a.second < b.second;
+    };
+    std::vector<Item> items;
+    for (int i = 0; i < 500; ++i) items.push_back({(i * 7919) % 5, "Z" + std::to_string((i * 104729) % 1000)});
+    std::vector<Item> sorted = items;
+    std::sort(sorted.begin(), sorted.end(), before);
+
+    for (size_t k : {size_t(0), size_t(1), size_t(3), size_t(100), size_t(499), size_t(500), size_t(501), size_t(5000)}) {
+        TopK<Item, decltype(before)> top(k, before);
+        for (const Item& x : items) top.push(x);
+        REQUIRE(top.full() == (k <= items.size()));
+        std::vector<Item> got = top.take();
+        REQUIRE(got.size() == std::min(k, items.size()));
+        REQUIRE(std::equal(got.begin(), got.end(), sorted.begin()));
+    }
+
+    // Nothing pushed, and k = 0 keeps nothing
+    TopK<Item, decltype(before)> none(3, before);
+    REQUIRE(none.take().empty());
+    TopK<Item, decltype(before)> zero(0, before);
+    zero.push({1, "A"});
+    REQUIRE(zero.take().empty());
+
+    // worst() is the item the next push has to beat
+    TopK<Item, decltype(before)> two(2, before);
+    two.push({5, "B"});
+    two.push({5, "A"});
+    two.push({5, "C"});
+    REQUIRE(two.worst() == Item{5, "B"});
+    two.push({6, "Z"});
+    REQUIRE(two.take() == std::vector<Item>{{6, "Z"}, {5, "A"}});
+
+    REQUIRE(preferFullSort(25, 100));
+    REQUIRE(!preferFullSort(24, 100));
+
+    // Every ranking query takes any k, the largest included
+    const std::string path = "d21.csv";
+    writeFile(path, {HDR, "1,A,X,2024-01-01 09:00,1.0,5.0", "2,B,Y,2024-01-02 10:00,2.0,7.0",
+                     "3,A,Y,2024-01-02 09:00,3.0,9.0"});
+    IngestOptions o;
+    o.trackDates = o.trackRoutes = o.trackMetrics = true;
+    TripAnalyzer exact, approx;
+    exact.setOptions(o);
+    exact.ingestFile(path);
+    o.approxEntries = 8;
+    approx.setOptions(o);
+    approx.ingestFile(path);
+    const int kMax = INT_MAX;
+    for (const TripAnalyzer* ta : {&exact, &approx}) {
+        size_t zones = 2, slots = 2;
+        REQUIRE(ta->topZones(kMax).size() == zones);
+        REQUIRE(ta->topBusySlots(kMax).size() == slots);
+        REQUIRE(ta->estimateTopZones(kMax).size() == zones);
+        REQUIRE(ta->estimateTopBusySlots(kMax).size() == slots);
+    }
+    REQUIRE(exact.topZones(kMax, 9, 10).size() == 2);
+    REQUIRE(exact.topZonesInDates(kMax, "2024-01-01", "2024-01-31").size() == 2);
+    REQUIRE(exact.topBusySlotsInDates(kMax, "2024-01-01", "2024-01-31").size() == 2);
+    REQUIRE(exact.topRoutes(kMax).size() == 3);
+    REQUIRE(exact.topDestinations("A", kMax).size() == 2);
+    REQUIRE(exact.topZonesByRevenue(kMax).size() == 2);
+    REQUIRE(exact.topBusySlotsByRevenue(kMax).size() == 2);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D22", "[D][D22]") {
+    const std::string path = "d22.csv";
+    std::vector<std::string> lines{HDR};
+    int id = 0;
+    auto trips = [&](const std::string& zone, int hour, int n) {
+        for (int i = 0; i < n; ++i)
+            lines.push_back(std::to_string(++id) + "," + zone + ",ZX,2024-01-01 " + (hour < 10 ? "0" : "") +
+                            std::to_string(hour) + ":00,1,1");
+    };
+    // Seen in an order that is neither the count nor the name order
+    trips("C", 5, 2);
+    trips("B", 5, 2);
+    trips("A", 5, 2);
+    trips("C", 3, 2);
+    trips("A", 7, 3);
+    trips("B", 3, 2);
+    trips("A", 3, 2);
+    writeFile(path, lines);
+
+    const std::vector<std::tuple<std::string, int, long long>> order{
+        {"A", 7, 3}, {"A", 3, 2}, {"A", 5, 2}, {"B", 3, 2}, {"B", 5, 2}, {"C", 3, 2}, {"C", 5, 2}};
+    auto check = [&](const TripAnalyzer& ta, int k) {
+        auto v = ta.topBusySlots(k);
+        REQUIRE(v.size() == (size_t)std::max(0, std::min<int>(k, (int)order.size())));
+        for (size_t i = 0; i < v.size(); ++i) {
+            REQUIRE(v[i].zone == std::get<0>(order[i]));
+            REQUIRE(v[i].hour == std::get<1>(order[i]));
+            REQUIRE(v[i].count == std::get<2>(order[i]));
+        }
+    };
+
+    // Growing k, cutting through ties, then shrinking it again
+    TripAnalyzer ta;
+    ta.ingestFile(path);
+    for (int k : {0, -3, 1, 2, 4, 6, 7, 8, 100, 3, 0, 1})
+        check(ta, k);
+
+    // The largest k first
+    TripAnalyzer big;
+    big.ingestFile(path);
+    for (int k : {1000, 5, 1, 0})
+        check(big, k);
+
+    auto zones = ta.topZones(10);
+    REQUIRE(zones.size() == 3);
+    REQUIRE(zones[1].zone == "B");
+    REQUIRE(zones[2].zone == "C");
+    REQUIRE(ta.topZones(0).empty());
+    REQUIRE(ta.topZones(-1).empty());
+
+    std::remove(path.c_str());
+}
+
+TEST_CASE("D23", "[D][D23]") {
+    // The whole file as writeTrips produces it
+    auto generate = [](const TripGenConfig& cfg) {
+        FILE* f = std::tmpfile();
+        REQUIRE(f != nullptr);
+        REQUIRE(writeTrips(cfg, f));
+        std::string out(std::ftell(f), '\0');
+        std::rewind(f);
+        REQUIRE(std::fread(&out[0], 1, out.size(), f) == out.size());
+        std::fclose(f);
+        return out;
+    };
+
+    // Output depends on the config, never on the thread count: rows that
+    // end mid-block, skew, dirty rows and CRLF included
+    TripGenConfig cfg;
+    cfg.rows = 3 * kGenBlockRows + 1234;
+    cfg.seed = 7;
+    cfg.zones = 5000;
+    cfg.zipf = 1.1;
+    cfg.hotShare = 0.05;
+    cfg.hours = HourMix::Rush;
+    cfg.dirtyShare = 0.02;
+    cfg.crlf = true;
+    std::string one = generate(cfg);
+    for (int t : {2, 3, 8}) {
+        cfg.threads = t;
+        REQUIRE(generate(cfg) == one);
+    }
+
+    // Row ranges are the same rows as in the whole file
+    std::string head;
+    generateTripRows(cfg, 0, cfg.rows, head);
+    REQUIRE(one.compare(one.find('\n') + 1, std::string::npos, head) == 0);
+
+    // A different seed gives a different file
+    cfg.seed = 8;
+    REQUIRE(generate(cfg) != one);
+}
+
+TEST_CASE("D24", "[D][D24]") {
+    CountTable t;
+    REQUIRE(t.get(42) == 0);
+    REQUIRE(t.memoryBytes() == 0);
+
+    // Keys spread like cellKey and routeKey values, each added key % 5 + 1 times
+    auto keyOf = [](uint64_t i) { return i << 32 | (i * 2654435761u) % 9000; };
+    for (uint64_t i = 0; i < 50000; ++i)
+        for (uint64_t r = 0; r <= i % 5; ++r) t.add(keyOf(i));
+    const uint64_t last = UINT64_MAX - 1;     // UINT64_MAX itself is reserved
+    t.add(last, 7);
+    REQUIRE(t.size() == 50001);
+    for (uint64_t i = 0; i < 50000; ++i) REQUIRE(t.get(keyOf(i)) == i % 5 + 1);
+    REQUIRE(t.get(last) == 7);
+    REQUIRE(t.get(keyOf(50000)) == 0);
+    REQUIRE(t.get(1) == 0);
+
+    // 16 bytes a slot, at most 70% of the slots used
+    size_t slots = t.memoryBytes() / 16;
+    REQUIRE(t.memoryBytes() % 16 == 0);
+    REQUIRE(t.size() * 10 <= slots * 7);
+    uint64_t sum = 0;
+    t.forEach([&](uint64_t, uint64_t c) { sum += c; });
+    REQUIRE(sum == 50000 / 5 * 15 + 7);
+
+    // reserve sizes the table up front
+    CountTable r;
+    r.reserve(10000);
+    size_t reserved = r.memoryBytes();
+    for (uint64_t i = 0; i < 10000; ++i) r.add(keyOf(i), 2);
+    REQUIRE(r.memoryBytes() == reserved);
+    REQUIRE(r.get(keyOf(9999)) == 2);
+
+    r.swap(t);
+    REQUIRE(r.get(last) == 7);
+    REQUIRE(t.get(last) == 0);
+    t.clear();
+    REQUIRE(t.empty());
+    REQUIRE(t.get(keyOf(1)) == 0);
+}
+
+TEST_CASE("D25", "[D][D25]") {
+    HourCounts h;
+    h.reserve(1000);
+    h.resize(1000);
+    for (uint32_t id = 0; id < 1000; ++id) h.add(id, (int)(id % 24));
+    // One-trip zones stay in their 24-byte records
+    REQUIRE(h.memoryBytes() == 1000 * 24);
+
+    // Three hours fit inline, in any order of arrival; a fourth moves the
+    // zone to a block of 32-bit counters
+    h.add(7, 20, 5);
+    h.add(7, 2, 3);
+    REQUIRE(h.memoryBytes() == 1000 * 24);
+    h.add(7, 11, 2);
+    REQUIRE(h.memoryBytes() > 1000 * 24);
+    REQUIRE(h.count(7, 7) == 1);
+    REQUIRE(h.count(7, 11) == 2);
+    REQUIRE(h.count(7, 2) == 3);
+    REQUIRE(h.count(7, 20) == 5);
+    REQUIRE(h.count(7, 0) == 0);
+    REQUIRE(h.total(7) == 11);
+    REQUIRE(h.hourMask(7) == (1u << 2 | 1u << 7 | 1u << 11 | 1u << 20));
+    std::vector<std::pair<int, long long>> seen;
+    h.forEachHour(7, [&](int hour, long long c) { seen.push_back({hour, c}); });
+    REQUIRE(seen == std::vector<std::pair<int, long long>>{{2, 3}, {7, 1}, {11, 2}, {20, 5}});
+
+    // A counter about to pass 32 bits moves to 64-bit counters, sparse or not
+    h.add(8, 3, UINT32_MAX);
+    h.add(8, 3, 2);
+    REQUIRE(h.count(8, 3) == (long long)UINT32_MAX + 2);
+    REQUIRE(h.count(8, 8) == 1);
+    h.add(7, 11, UINT32_MAX);
+    REQUIRE(h.count(7, 11) == (long long)UINT32_MAX + 2);
+    REQUIRE(h.count(7, 20) == 5);
+    REQUIRE(h.total(7) == (long long)UINT32_MAX + 11);
+
+    for (uint32_t id = 9; id < 1000; ++id) REQUIRE(h.count(id, (int)(id % 24)) == 1);
+
+    h.clear();
+    REQUIRE(h.empty());
+}
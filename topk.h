@@ -0,0 +1,48 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Bounded selection of the k best items, where before(a, b) is true when a
+// ranks ahead of b. A max-heap on before keeps the worst kept item on top,
+// so m pushes cost O(m log k) time and O(min(k, m)) memory.
+template <class T, class Before>
+class TopK {
+public:
+    // k may be far larger than the number of items pushed (any k a caller
+    // asks for), so the heap grows with its contents instead of reserving k.
+    TopK(size_t k, Before before) : k(k), before(before) {}
+
+    bool full() const { return heap.size() >= k; }
+    const T& worst() const { return heap.front(); }
+
+    void push(T x) {
+        if (k == 0) return;
+        if (!full()) {
+            heap.push_back(std::move(x));
+            push_heap(heap.begin(), heap.end(), before);
+        } else if (before(x, heap.front())) {
+            pop_heap(heap.begin(), heap.end(), before);
+            heap.back() = std::move(x);
+            push_heap(heap.begin(), heap.end(), before);
+        }
+    }
+
+    // The kept items, best first. Leaves the selection empty.
+    vector<T> take() {
+        sort_heap(heap.begin(), heap.end(), before);
+        return std::move(heap);
+    }
+
+private:
+    size_t k;
+    Before before;
+    vector<T> heap;
+};
+
+// Use the heap only while k is small next to m; near k == m a single sort
+// of everything is cheaper.
+inline bool preferFullSort(size_t k, size_t m) { return k * 4 >= m; }
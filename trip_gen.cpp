@@ -0,0 +1,256 @@
+#include "trip_gen.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+struct Rng {
+    uint64_t s;
+    explicit Rng(uint64_t seed) : s(seed) {}
+    uint64_t next() {  // splitmix64
+        uint64_t z = (s += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+    uint64_t below(uint64_t n) { return next() % n; }
+    double unit() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+};
+
+// Zipf(s) over 1..n by rejection-inversion (Hormann & Derflinger): O(1)
+// memory and time per sample, so cardinality can be in the billions.
+class ZipfSampler {
+public:
+    ZipfSampler(long long n, double s) : n(n), s(s) {
+        hX1 = H(1.5) - 1.0;
+        hN = H(n + 0.5);
+        cut = 2.0 - Hinv(H(2.5) - h(2.0));
+    }
+
+    long long sample(Rng& rng) const {
+        for (;;) {
+            double u = hN + rng.unit() * (hX1 - hN);
+            double x = Hinv(u);
+            long long k = (long long)(x + 0.5);
+            if (k < 1) k = 1;
+            else if (k > n) k = n;
+            if (k - x <= cut || u >= H(k + 0.5) - h((double)k)) return k;
+        }
+    }
+
+private:
+    long long n;
+    double s, hX1, hN, cut;
+
+    static double expm1OverX(double x) { return fabs(x) > 1e-8 ? expm1(x) / x : 1.0 + x * 0.5; }
+    static double log1pOverX(double x) { return fabs(x) > 1e-8 ? log1p(x) / x : 1.0 - x * 0.5; }
+    double h(double x) const { return exp(-s * log(x)); }
+    double H(double x) const { double lx = log(x); return expm1OverX((1.0 - s) * lx) * lx; }
+    double Hinv(double x) const {
+        double t = x * (1.0 - s);
+        if (t < -1.0) t = -1.0;
+        return exp(log1pOverX(t) * x);
+    }
+};
+
+const char* const kDirtyNames[DirtyKindCount] = {
+    "empty_zone", "empty_time", "too_few_fields", "bad_time", "hour_range", "blank"};
+
+// Hour weights for HourMix::Rush, out of 100.
+const int kRushWeights[24] = {1, 1, 1, 1, 1, 2, 4, 8, 10, 7, 4, 4,
+                              4, 4, 4, 5, 7, 10, 8, 5, 3, 3, 2, 1};
+
+inline void putUint(string& out, unsigned long long v) {
+    char tmp[20];
+    int n = 0;
+    do { tmp[n++] = char('0' + v % 10); v /= 10; } while (v);
+    while (n) out += tmp[--n];
+}
+
+inline void put2(string& out, int v) {
+    out += char('0' + v / 10);
+    out += char('0' + v % 10);
+}
+
+// Civil date for a day offset from 2024-01-01.
+void putDate(string& out, int day) {
+    static const int mdays[12] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int y = 2024;
+    for (;;) {
+        bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+        int len = leap ? 366 : 365;
+        if (day < len) break;
+        day -= len;
+        y++;
+    }
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    int m = 0;
+    while (day >= mdays[m] - (m == 1 && !leap)) day -= mdays[m] - (m == 1 && !leap), m++;
+    putUint(out, y);
+    out += '-';
+    put2(out, m + 1);
+    out += '-';
+    put2(out, day + 1);
+}
+
+// Maps a popularity rank onto a zone number so that the busiest zones are
+// not simply ZONE_0, ZONE_1, ... The multiplier is coprime to the zone
+// count, so the map is a bijection.
+long long scrambleStep(long long zones) {
+    long long p = (long long)(zones * 0.6180339887) | 1;
+    auto gcd = [](long long a, long long b) { while (b) { long long t = a % b; a = b; b = t; } return a; };
+    while (gcd(p, zones) != 1) p += 2;
+    return p;
+}
+
+struct Generator {
+    const TripGenConfig& cfg;
+    ZipfSampler zipf;
+    long long step = 1;
+    unsigned dirtyList[DirtyKindCount];
+    int dirtyCount = 0;
+
+    explicit Generator(const TripGenConfig& c)
+        : cfg(c), zipf(c.zones > 0 ? c.zones : 1, c.zipf > 0 ? c.zipf : 1.0) {
+        if (cfg.zones > 1) step = scrambleStep(cfg.zones);
+        for (int k = 0; k < DirtyKindCount; k++)
+            if (cfg.dirtyKinds & (1u << k)) dirtyList[dirtyCount++] = k;
+    }
+
+    int hour(Rng& rng) const {
+        switch (cfg.hours) {
+            case HourMix::Fixed: return cfg.fixedHour;
+            case HourMix::Rush: {
+                int r = (int)rng.below(100);
+                for (int h = 0; h < 24; h++)
+                    if ((r -= kRushWeights[h]) < 0) return h;
+                return 23;
+            }
+            default: return (int)rng.below(24);
+        }
+    }
+
+    void zone(Rng& rng, long long id, string& out) const {
+        if (cfg.hotShare > 0 && rng.unit() < cfg.hotShare) {
+            out += "ZONE_HOT";
+            return;
+        }
+        long long z;
+        if (cfg.zones <= 0) z = id;
+        else if (cfg.zipf > 0) z = (long long)((unsigned __int128)(zipf.sample(rng) - 1) * step % cfg.zones);
+        else z = (long long)rng.below(cfg.zones);
+        out += "ZONE_";
+        putUint(out, z);
+    }
+
+    void row(Rng& rng, long long id, string& out) const {
+        int dirty = -1;
+        if (dirtyCount > 0 && cfg.dirtyShare > 0 && rng.unit() < cfg.dirtyShare)
+            dirty = (int)dirtyList[rng.below(dirtyCount)];
+
+        if (dirty != DirtyBlankLine) {
+            putUint(out, id);
+            out += ',';
+        }
+
+        if (dirty >= 0) {
+            switch (dirty) {
+                case DirtyEmptyZone:    out += ",ZONE_1,2024-01-01 10:00,1.0,5.00"; break;
+                case DirtyEmptyTime:    out += "ZONE_1,ZONE_2,,1.0,5.00"; break;
+                case DirtyTooFewFields: out += "ZONE_1,ZONE_2,2024-01-01 10:00"; break;
+                case DirtyBadTime:      out += "ZONE_1,ZONE_2,NOT_A_DATE,1.0,5.00"; break;
+                case DirtyHourRange:
+                    out += "ZONE_1,ZONE_2,2024-01-01 ";
+                    putUint(out, 24 + rng.below(76));
+                    out += ":00,1.0,5.00";
+                    break;
+                default: break;     // blank line
+            }
+        } else {
+            zone(rng, id, out);
+            out += ',';
+            out += "ZONE_";
+            putUint(out, rng.below(cfg.zones > 0 ? cfg.zones : 1000));
+            out += ',';
+            putDate(out, (int)rng.below(cfg.days > 0 ? cfg.days : 1));
+            out += ' ';
+            put2(out, hour(rng));
+            out += ':';
+            put2(out, (int)rng.below(60));
+
+            int dist = 5 + (int)rng.below(496);     // 0.5 .. 50.0 km, tenths
+            long long fare = 250 + dist * 175 / 10 + (long long)rng.below(300);  // cents
+            out += ',';
+            putUint(out, dist / 10);
+            out += '.';
+            out += char('0' + dist % 10);
+            out += ',';
+            putUint(out, fare / 100);
+            out += '.';
+            put2(out, (int)(fare % 100));
+        }
+        if (cfg.crlf) out += '\r';
+        out += '\n';
+    }
+};
+
+}  // namespace
+
+int dirtyKindFromName(const string& name) {
+    for (int k = 0; k < DirtyKindCount; k++)
+        if (name == kDirtyNames[k]) return k;
+    return -1;
+}
+
+void generateTripRows(const TripGenConfig& cfg, long long first, long long count, string& out) {
+    Generator gen(cfg);
+    long long end = first + count;
+    for (long long b = first / kGenBlockRows; b * kGenBlockRows < end; b++) {
+        // One RNG stream per block; start mid-block by skipping its rows.
+        Rng rng(cfg.seed * 0x9e3779b97f4a7c15ULL + (uint64_t)b * 0xd1b54a32d192ed03ULL);
+        long long from = b * kGenBlockRows, to = min(end, from + kGenBlockRows);
+        string skip;
+        for (long long i = from; i < to; i++) {
+            if (i < first) {
+                skip.clear();
+                gen.row(rng, i + 1, skip);
+            } else {
+                gen.row(rng, i + 1, out);
+            }
+        }
+    }
+}
+
+bool writeTrips(const TripGenConfig& cfg, FILE* f) {
+    if (cfg.header) {
+        string h = "TripID,PickupZoneID,DropoffZoneID,PickupDateTime,DistanceKm,FareAmount";
+        h += cfg.crlf ? "\r\n" : "\n";
+        if (fwrite(h.data(), 1, h.size(), f) != h.size()) return false;
+    }
+
+    // Rounds of one block per thread, generated in parallel and written in
+    // block order.
+    int t = max(1, cfg.threads);
+    long long blocks = (cfg.rows + kGenBlockRows - 1) / kGenBlockRows;
+    vector<string> bufs(t);
+
+    for (long long b0 = 0; b0 < blocks; b0 += t) {
+        int n = (int)min<long long>(t, blocks - b0);
+        auto work = [&](int i) {
+            long long first = (b0 + i) * kGenBlockRows;
+            bufs[i].clear();
+            generateTripRows(cfg, first, min(kGenBlockRows, cfg.rows - first), bufs[i]);
+        };
+
+        vector<thread> workers;
+        for (int i = 1; i < n; i++) workers.emplace_back(work, i);
+        work(0);
+        for (auto& w : workers) w.join();
+
+        for (int i = 0; i < n; i++)
+            if (fwrite(bufs[i].data(), 1, bufs[i].size(), f) != bufs[i].size()) return false;
+    }
+    return fflush(f) == 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Synthetic trip CSV in the six-column schema
+//   TripID,PickupZoneID,DropoffZoneID,PickupDateTime,DistanceKm,FareAmount
+//
+// Output depends only on the config (seed included), never on the thread
+// count: rows are produced in fixed blocks of kGenBlockRows, each from its
+// own RNG stream, and written in block order.
+
+enum class HourMix {
+    Uniform,    // every hour equally likely
+    Rush,       // peaks around 08:00 and 17:00 over a flat base
+    Fixed,      // always fixedHour
+};
+
+enum DirtyKind {
+    DirtyEmptyZone,
+    DirtyEmptyTime,
+    DirtyTooFewFields,
+    DirtyBadTime,       // no parsable hour
+    DirtyHourRange,     // hour 24..99
+    DirtyBlankLine,
+    DirtyKindCount
+};
+
+struct TripGenConfig {
+    long long rows = 1000000;
+    uint64_t seed = 1;
+    long long zones = 1000;     // distinct pickup zones; 0 = a new zone per row
+    double zipf = 0;            // zone skew exponent, 0 = uniform
+    double hotShare = 0;        // extra share of rows on "ZONE_HOT"
+    HourMix hours = HourMix::Uniform;
+    int fixedHour = 12;
+    int days = 366;             // pickup dates spread from 2024-01-01
+    double dirtyShare = 0;      // share of malformed rows
+    unsigned dirtyKinds = (1u << DirtyKindCount) - 1;   // bit per DirtyKind
+    bool header = true;
+    bool crlf = false;
+    int threads = 1;
+};
+
+const long long kGenBlockRows = 65536;
+
+// Appends rows [first, first + count) to out.
+void generateTripRows(const TripGenConfig& cfg, long long first, long long count, string& out);
+
+// Writes the whole file (header included) to f. False on a write error.
+bool writeTrips(const TripGenConfig& cfg, FILE* f);
+
+// Parses a DirtyKind name ("empty_zone", "empty_time", "too_few_fields",
+// "bad_time", "hour_range", "blank"); -1 if unknown.
+int dirtyKindFromName(const string& name);
@@ -0,0 +1,323 @@
+#include "trip_server.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// A request line longer than this closes the connection.
+static const size_t kMaxLine = 1 << 16;
+
+// Unsent reply bytes past which a client's requests wait.
+static const size_t kMaxOut = 1 << 20;
+
+static void setNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Whole decimal number in [lo, hi].
+static bool parseInt(string_view s, long long lo, long long hi, long long& out) {
+    if (s.empty() || s.size() > 18) return false;
+    long long v = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9') return false;
+        v = v * 10 + (c - '0');
+    }
+    if (v < lo || v > hi) return false;
+    out = v;
+    return true;
+}
+
+// Splits off the first space-separated word of s.
+static string_view nextWord(string_view& s) {
+    size_t sp = s.find(' ');
+    string_view w = s.substr(0, sp);
+    s = sp == string_view::npos ? string_view() : s.substr(sp + 1);
+    return w;
+}
+
+TripServer::TripServer(unique_ptr<TripAnalyzer> analyzer) : live(std::move(analyzer)) {
+    if (pipe(wakeFd) == 0) {
+        setNonBlocking(wakeFd[0]);
+        setNonBlocking(wakeFd[1]);
+    }
+}
+
+TripServer::~TripServer() {
+    if (reloader.joinable()) reloader.join();
+    for (auto& c : clients) close(c->fd);
+    if (listenFd >= 0) close(listenFd);
+    for (int fd : wakeFd)
+        if (fd >= 0) close(fd);
+}
+
+bool TripServer::listen(const string& socketPath) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(addr.sun_path) || wakeFd[0] < 0)
+        return false;
+    memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    // A socket file left by a server that died would make bind fail.
+    struct stat sb;
+    if (lstat(socketPath.c_str(), &sb) == 0 && S_ISSOCK(sb.st_mode)) unlink(socketPath.c_str());
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(fd, 64) != 0) {
+        close(fd);
+        return false;
+    }
+    setNonBlocking(fd);
+    listenFd = fd;
+    path = socketPath;
+    return true;
+}
+
+void TripServer::stop() {
+    stopping = true;
+    wake();
+}
+
+void TripServer::wake() {
+    char b = 0;
+    ssize_t r = write(wakeFd[1], &b, 1);   // a full pipe already means "wake up"
+    (void)r;
+}
+
+void TripServer::run() {
+    vector<pollfd> fds;
+    while (!stopping && listenFd >= 0) {
+        fds.clear();
+        fds.push_back({listenFd, POLLIN, 0});
+        fds.push_back({wakeFd[0], POLLIN, 0});
+        for (auto& c : clients) {
+            short ev = c->out.empty() ? 0 : POLLOUT;
+            if (!c->peerDone && !paused(*c)) ev |= POLLIN;
+            fds.push_back({c->fd, ev, 0});
+        }
+
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents) {
+            char buf[64];
+            while (read(wakeFd[0], buf, sizeof(buf)) > 0) {}
+            finishReload();
+        }
+        // Clients accepted below are polled from the next round on.
+        size_t polled = fds.size() - 2;
+        for (size_t i = 0; i < polled; i++) {
+            Client& c = *clients[i];
+            short ev = fds[i + 2].revents;
+            if (c.fd < 0 || !ev) continue;
+            if (ev & (POLLHUP | POLLERR)) {
+                // Gone both ways: nothing more can be read or delivered.
+                c.out.clear();
+                c.closing = true;
+            } else if (ev & POLLIN) {
+                readClient(c);
+            }
+            service(c);
+        }
+        if (fds[0].revents & POLLIN) acceptClients();
+
+        clients.erase(remove_if(clients.begin(), clients.end(),
+                                [](const unique_ptr<Client>& c) { return c->fd < 0; }),
+                      clients.end());
+    }
+
+    if (reloader.joinable()) reloader.join();
+    for (auto& c : clients) close(c->fd);
+    clients.clear();
+    if (listenFd >= 0) {
+        close(listenFd);
+        listenFd = -1;
+        unlink(path.c_str());
+    }
+}
+
+void TripServer::acceptClients() {
+    for (;;) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        clients.push_back(make_unique<Client>(Client{fd, nextId++, {}, {}}));
+    }
+}
+
+// Reads what the socket has, up to a bound so a fast sender cannot grow
+// c.in without limit; the rest is picked up on the next POLLIN.
+void TripServer::readClient(Client& c) {
+    char buf[1 << 14];
+    while (c.in.size() < kMaxOut) {
+        ssize_t n = read(c.fd, buf, sizeof(buf));
+        if (n > 0) {
+            c.in.append(buf, (size_t)n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        c.peerDone = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        break;
+    }
+}
+
+// Requests wait while the client's RELOAD is running, so that later replies
+// cannot overtake its reply, and while its replies are piling up unread.
+bool TripServer::paused(const Client& c) const {
+    return c.id == reloadClient || c.out.size() >= kMaxOut;
+}
+
+// Runs the complete request lines buffered so far, up to a pause. Requests
+// already sent are still answered when the peer has shut down its side;
+// QUIT and SHUTDOWN end the processing.
+void TripServer::processInput(Client& c) {
+    size_t start = 0;
+    for (size_t nl; !c.closing && !stopping && !paused(c) &&
+                    (nl = c.in.find('\n', start)) != string::npos;
+         start = nl + 1) {
+        string_view line(c.in.data() + start, nl - start);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        execute(c, line);
+    }
+    c.in.erase(0, start);
+    if (c.in.size() > kMaxLine) {
+        c.out += "ERR line too long\n";
+        c.closing = true;
+    }
+    if (c.peerDone && !paused(c) && c.in.find('\n') == string::npos) c.closing = true;
+}
+
+// Alternates running requests and sending replies until the client is
+// paused, the socket is full, or there is nothing left to do.
+void TripServer::service(Client& c) {
+    do {
+        processInput(c);
+        flush(c);
+    } while (c.fd >= 0 && !c.closing && !stopping && !paused(c) &&
+             c.in.find('\n') != string::npos);
+}
+
+// Writes what the socket takes now; the rest waits for POLLOUT. A closing
+// client is dropped once everything is out.
+void TripServer::flush(Client& c) {
+    while (!c.out.empty()) {
+        ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if (n > 0) {
+            c.out.erase(0, (size_t)n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        c.out.clear();
+        c.closing = true;
+        break;
+    }
+    if (c.closing) {
+        close(c.fd);
+        c.fd = -1;
+        if (reloadClient == c.id) reloadClient = kGone;
+    }
+}
+
+void TripServer::execute(Client& c, string_view line) {
+    string_view args = line;
+    string_view cmd = nextWord(args);
+    string& out = c.out;
+    long long n;
+
+    if (cmd == "PING") {
+        out += "OK 0\n";
+    } else if (cmd == "ZONES" && parseInt(args, 0, INT32_MAX, n)) {
+        auto v = live->topZones((int)n);
+        out += "OK " + to_string(v.size()) + "\n";
+        for (const auto& z : v) out += z.zone + "," + to_string(z.count) + "\n";
+    } else if (cmd == "SLOTS" && parseInt(args, 0, INT32_MAX, n)) {
+        auto v = live->topBusySlots((int)n);
+        out += "OK " + to_string(v.size()) + "\n";
+        for (const auto& s : v)
+            out += s.zone + "," + to_string(s.hour) + "," + to_string(s.count) + "\n";
+    } else if (cmd == "ZONE" && !args.empty()) {
+        out += "OK 1\n" + to_string(live->zoneCount(string(args))) + "\n";
+    } else if (cmd == "SLOT" && parseInt(nextWord(args), 0, 23, n) && !args.empty()) {
+        out += "OK 1\n" + to_string(live->slotCount(string(args), (int)n)) + "\n";
+    } else if (cmd == "STATS" && args.empty()) {
+        IngestStats s = live->ingestStats();
+        out += "OK 1\nbytes=" + to_string(s.bytesRead) + " rows=" + to_string(s.rows) +
+               " accepted=" + to_string(s.rowsAccepted) + " files=" + to_string(s.filesRead) +
+               " ingest_ns=" + to_string(s.ingestNs) + " generation=" + to_string(generation) +
+               " clients=" + to_string(clients.size()) + "\n";
+    } else if (cmd == "APPEND" && !args.empty()) {
+        if (reloadClient != 0) out += "ERR reload in progress\n";
+        else if (!live->appendFrom(string(args))) out += "ERR cannot open " + string(args) + "\n";
+        else out += "OK 1\nrows=" + to_string(live->ingestStats().rowsAccepted) + "\n";
+    } else if (cmd == "RELOAD" && !args.empty()) {
+        vector<string> paths;
+        while (!args.empty()) {
+            string_view w = nextWord(args);
+            if (!w.empty()) paths.emplace_back(w);
+        }
+        startReload(c, paths);
+    } else if (cmd == "QUIT") {
+        c.closing = true;
+    } else if (cmd == "SHUTDOWN") {
+        out += "OK 0\n";
+        stopping = true;
+    } else {
+        out += "ERR bad request\n";
+    }
+}
+
+void TripServer::startReload(Client& c, const vector<string>& paths) {
+    if (reloadClient != 0) {
+        c.out += "ERR reload in progress\n";
+        return;
+    }
+    if (reloader.joinable()) reloader.join();
+    reloadClient = c.id;
+    IngestOptions o = live->options();
+    reloader = thread([this, paths, o] {
+        auto fresh = make_unique<TripAnalyzer>();
+        fresh->setOptions(o);
+        struct stat sb;
+        if (paths.size() == 1 && stat(paths[0].c_str(), &sb) == 0 && S_ISDIR(sb.st_mode))
+            fresh->ingestDirectory(paths[0]);
+        else
+            fresh->ingestFiles(paths);
+        {
+            lock_guard<mutex> lock(reloadMutex);
+            reloaded = std::move(fresh);
+        }
+        wake();
+    });
+}
+
+void TripServer::finishReload() {
+    unique_ptr<TripAnalyzer> fresh;
+    {
+        lock_guard<mutex> lock(reloadMutex);
+        fresh = std::move(reloaded);
+    }
+    if (!fresh) return;
+
+    // A reload that could not read all of its files keeps the old data
+    // rather than going live with part of it, or with nothing.
+    IngestStats s = fresh->ingestStats();
+    bool ok = s.filesRead > 0 && s.filesFailed == 0;
+    if (ok) {
+        live = std::move(fresh);
+        generation++;
+    }
+    uint64_t id = reloadClient;
+    reloadClient = 0;
+    string counts = "files=" + to_string(s.filesRead) + " failed=" + to_string(s.filesFailed);
+    for (auto& c : clients)
+        if (c->id == id && c->fd >= 0) {
+            if (ok) c->out += "OK 1\nrows=" + to_string(s.rowsAccepted) + " " + counts + "\n";
+            else c->out += "ERR reload failed, old data kept: " + counts + "\n";
+            service(*c);    // then the requests held behind the RELOAD
+        }
+}
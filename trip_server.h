@@ -0,0 +1,98 @@
+#pragma once
+#include "analyzer.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Answers queries against a resident TripAnalyzer over a Unix domain
+// socket, so the ingest is paid once instead of per question.
+//
+// The protocol is line based. A request is one line, a command and its
+// arguments separated by single spaces; a zone is always the last argument
+// and may itself contain spaces. A reply is "OK <n>" followed by n result
+// lines, or a single "ERR <reason>" line. Requests may be pipelined.
+//
+//   PING                   OK 0
+//   ZONES <k>              zone,count per line (topZones)
+//   SLOTS <k>              zone,hour,count per line (topBusySlots)
+//   ZONE <zone>            the zone's trip count
+//   SLOT <hour> <zone>     the slot's trip count
+//   STATS                  key=value pairs of the last ingest
+//   APPEND <path>          rows=<n> added by appendFrom
+//   RELOAD <path>...       rows=<n> once a fresh ingest of the files, or
+//                          of one directory's *.csv files, is live; ERR
+//                          and the old data kept if a file could not be
+//                          read, or there was none
+//   QUIT                   closes the connection
+//   SHUTDOWN               stops the server
+//
+// One thread runs the event loop over all connections, so requests are
+// answered one at a time: a point count is a dictionary
+// probe and a ranking reads the analyzer's cached order. RELOAD ingests on
+// a separate thread while the old analyzer keeps answering, and swaps the
+// new one in between requests. Replies always come in request order: the
+// client that sent RELOAD has its later requests held until the reload's
+// reply, and APPEND from other clients is refused while a reload runs,
+// since the analyzer it would change is about to be replaced. A client
+// whose unsent replies pass kMaxOut is not read from until they drain.
+class TripServer {
+public:
+    explicit TripServer(unique_ptr<TripAnalyzer> analyzer);
+    ~TripServer();
+
+    TripServer(const TripServer&) = delete;
+    TripServer& operator=(const TripServer&) = delete;
+
+    // Binds socketPath, replacing a stale socket file. False on failure.
+    bool listen(const string& socketPath);
+
+    // Serves until SHUTDOWN or stop(); removes the socket file on return.
+    void run();
+
+    // Safe from any thread, including a signal handler.
+    void stop();
+
+    const TripAnalyzer& analyzer() const { return *live; }
+
+private:
+    struct Client {
+        int fd;
+        uint64_t id;
+        string in, out;
+        bool peerDone = false;  // the peer sends no more; close after its requests
+        bool closing = false;   // close once out is flushed
+    };
+
+    unique_ptr<TripAnalyzer> live;
+    string path;
+    int listenFd = -1;
+    int wakeFd[2] = {-1, -1};
+    atomic<bool> stopping{false};
+    vector<unique_ptr<Client>> clients;
+    uint64_t nextId = 1;
+
+    thread reloader;
+    mutex reloadMutex;
+    unique_ptr<TripAnalyzer> reloaded;  // set by the reloader when done
+    uint64_t reloadClient = 0;          // 0 = no reload running
+    static constexpr uint64_t kGone = ~0ull;    // the reload's client hung up
+    uint64_t generation = 0;
+
+    bool paused(const Client& c) const;
+    void acceptClients();
+    void readClient(Client& c);
+    void processInput(Client& c);
+    void service(Client& c);
+    void flush(Client& c);
+    void execute(Client& c, string_view line);
+    void startReload(Client& c, const vector<string>& paths);
+    void finishReload();
+    void wake();
+};
@@ -0,0 +1,121 @@
+#include "zone_dict.h"
+#include <cstring>
+#include <utility>
+
+static inline uint64_t load64(const char* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t mix(uint64_t x) {
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ULL;
+    x ^= x >> 32;
+    return x;
+}
+
+// Word-at-a-time hash; zone ids are short, so this is a handful of
+// multiplies per row instead of a byte loop.
+uint64_t ZoneDictionary::hash(string_view s) {
+    const char* p = s.data();
+    size_t n = s.size();
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ n;
+
+    for (; n >= 8; p += 8, n -= 8)
+        h = mix(h ^ load64(p)) + 0x9e3779b97f4a7c15ULL;
+
+    uint64_t tail = 0;
+    memcpy(&tail, p, n);
+    return mix(h ^ tail ^ (n << 59));
+}
+
+uint32_t ZoneDictionary::slotHash(string_view s) {
+    uint32_t h = (uint32_t)hash(s);
+    return h ? h : 1;
+}
+
+bool ZoneDictionary::matches(const Slot& sl, uint32_t h, string_view s) const {
+    if (sl.hash != h || sl.len != s.size()) return false;
+    if (s.size() <= kInline) return memcmp(sl.key, s.data(), s.size()) == 0;
+    return names[sl.id] == s;
+}
+
+size_t ZoneDictionary::lookup(uint32_t h, string_view s) const {
+    if (slots.empty()) return SIZE_MAX;
+
+    size_t mask = slots.size() - 1;
+    size_t i = h & mask;
+    for (size_t dist = 0;; dist++, i = (i + 1) & mask) {
+        const Slot& sl = slots[i];
+        if (sl.hash == 0) return SIZE_MAX;
+        // Robin Hood invariant: once we are further from home than the
+        // resident is from its own, the key cannot be further along.
+        if (((i - sl.hash) & mask) < dist) return SIZE_MAX;
+        if (matches(sl, h, s)) return i;
+    }
+}
+
+void ZoneDictionary::place(Slot sl) {
+    size_t mask = slots.size() - 1;
+    size_t i = sl.hash & mask;
+    for (size_t dist = 0;; dist++, i = (i + 1) & mask) {
+        Slot& cur = slots[i];
+        if (cur.hash == 0) {
+            cur = sl;
+            return;
+        }
+        size_t curDist = (i - cur.hash) & mask;
+        if (curDist < dist) {
+            std::swap(cur, sl);
+            dist = curDist;
+        }
+    }
+}
+
+void ZoneDictionary::grow() {
+    vector<Slot> old;
+    old.swap(slots);
+    slots.assign(old.empty() ? 64 : old.size() * 2, Slot());
+    for (const Slot& sl : old)
+        if (sl.hash != 0) place(sl);
+}
+
+uint32_t ZoneDictionary::intern(string_view zone) {
+    uint32_t h = slotHash(zone);
+    size_t i = lookup(h, zone);
+    if (i != SIZE_MAX) return slots[i].id;
+
+    // Keep the load factor at or below 0.8.
+    if ((names.size() + 1) * 5 > slots.size() * 4) grow();
+
+    Slot sl;
+    sl.hash = h;
+    sl.id = (uint32_t)names.size();
+    sl.len = (uint32_t)zone.size();
+    if (zone.size() <= kInline) memcpy(sl.key, zone.data(), zone.size());
+
+    names.emplace_back(zone);
+    place(sl);
+    return sl.id;
+}
+
+uint32_t ZoneDictionary::find(string_view zone) const {
+    size_t i = lookup(slotHash(zone), zone);
+    return i == SIZE_MAX ? npos : slots[i].id;
+}
+
+void ZoneDictionary::reserve(size_t n) {
+    while (n * 5 > slots.size() * 4) grow();
+    names.reserve(n);
+}
+
+void ZoneDictionary::clear() {
+    slots.clear();
+    names.clear();
+}
+
+void ZoneDictionary::swap(ZoneDictionary& other) {
+    slots.swap(other.slots);
+    names.swap(other.names);
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// Interns zone strings into dense ids 0, 1, 2, ... in first-seen order, so
+// per-zone data can live in plain vectors indexed by id.
+//
+// The index is a Robin Hood open-addressing table of 32-byte slots. Each
+// slot holds the key's hash and length and, for keys up to kInline bytes,
+// the key itself, so a lookup for a typical zone id touches one cache line
+// and never builds a temporary string.
+class ZoneDictionary {
+public:
+    static const uint32_t npos = UINT32_MAX;
+
+    uint32_t intern(string_view zone);
+    uint32_t find(string_view zone) const;   // npos if unknown
+
+    const string& name(uint32_t id) const { return names[id]; }
+    size_t size() const { return names.size(); }
+    bool empty() const { return names.empty(); }
+
+    void reserve(size_t n);
+    void clear();
+    void swap(ZoneDictionary& other);
+
+    static uint64_t hash(string_view s);
+
+private:
+    static const size_t kInline = 20;
+
+    struct Slot {
+        uint32_t hash = 0;  // 0 marks an empty slot
+        uint32_t id = 0;
+        uint32_t len = 0;
+        char key[kInline];
+    };
+
+    vector<Slot> slots;     // size is zero or a power of two
+    vector<string> names;
+
+    static uint32_t slotHash(string_view s);
+    bool matches(const Slot& sl, uint32_t h, string_view s) const;
+    size_t lookup(uint32_t h, string_view s) const;  // slot index or SIZE_MAX
+    void place(Slot sl);
+    void grow();
+};